@@ -0,0 +1,260 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <map>
+#include <set>
+#include "bsp.h"
+#include "depends.h"
+#include "animations.h"
+
+/* Longest chain followed, real ones have ten frames at most */
+#define MAX_ANIM_FRAMES 64
+
+/*
+ * Follow the animname links from a texture. The chain stops when it
+ * comes back to a frame already seen or leads to a missing texture.
+ */
+static std::vector<std::string> walChain(const std::map<std::string, std::string>& next, const std::string& start)
+{
+    std::vector<std::string> frames(1, start);
+    std::set<std::string> seen(frames.begin(), frames.end());
+    std::map<std::string, std::string>::const_iterator it = next.find(start);
+    while (it != next.end() && !it->second.empty() && frames.size() < MAX_ANIM_FRAMES) {
+        const std::string& name = it->second;
+        if (seen.count(name) || next.find(name) == next.end()) {
+            break;
+        }
+        frames.push_back(name);
+        seen.insert(name);
+        it = next.find(name);
+    }
+    return frames;
+}
+
+static bool writeSheet(const char *outPath, const std::vector<std::string>& frames)
+{
+    std::vector<uint32_t *> pixels(frames.size(), NULL);
+    std::vector<int> widths(frames.size()), heights(frames.size());
+    int width = 0, height = 0;
+    bool r = true;
+
+    for (size_t i = 0; i < frames.size() && r; i++) {
+        /* the frame names are lowercased, the entries may not be */
+        int entry = lookupEntry(("textures/" + frames[i] + ".wal").c_str());
+        pixels[i] = entry >= 0 ? loadWal(entries[entry], &widths[i], &heights[i]) : NULL;
+        if (pixels[i] == NULL) {
+            r = false;
+            break;
+        }
+        width += widths[i];
+        if (heights[i] > height) {
+            height = heights[i];
+        }
+    }
+
+    if (r) {
+        /* frames side by side, smaller ones padded with transparency */
+        std::vector<uint32_t> sheet(size_t(width) * height, 0);
+        int x0 = 0;
+        for (size_t i = 0; i < frames.size(); i++) {
+            for (int y = 0; y < heights[i]; y++) {
+                memcpy(&sheet[size_t(y) * width + x0], &pixels[i][y * widths[i]], widths[i] * 4);
+            }
+            x0 += widths[i];
+        }
+
+        char fullpath[1024];
+        r = createOutputPath(outPath, ("textures/" + frames[0] + ".wal").c_str(), ".anim.png",
+                             fullpath, sizeof(fullpath)) &&
+            writePng(fullpath, width, height, sheet.data());
+    }
+
+    for (uint32_t *p : pixels) {
+        free(p);
+    }
+    return r;
+}
+
+static bool writeAnimationsJson(const char *outPath, const std::map<std::string, std::vector<std::string> >& chains)
+{
+    char fullpath[1024];
+    if (!createOutputPath(outPath, "textures/animations.json", NULL, fullpath, sizeof(fullpath))) {
+        return false;
+    }
+
+    FILE *f = fopen(fullpath, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", fullpath);
+        return false;
+    }
+
+    fputs("{\n", f);
+    size_t n = 0;
+    for (std::map<std::string, std::vector<std::string> >::const_iterator it = chains.begin();
+         it != chains.end(); ++it, ++n) {
+        fputs("  ", f);
+        writeJsonString(f, it->first.c_str(), int(it->first.size()));
+        fputs(": [", f);
+        for (size_t i = 0; i < it->second.size(); i++) {
+            if (i) {
+                fputs(", ", f);
+            }
+            writeJsonString(f, it->second[i].c_str(), int(it->second[i].size()));
+        }
+        fputs(n + 1 < chains.size() ? "],\n" : "]\n", f);
+    }
+    fputs("}\n", f);
+
+    bool r = !ferror(f);
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", fullpath);
+        return false;
+    }
+    return true;
+}
+
+static bool exportTexinfoAnimations(const fileEntry& entry, const char *outPath)
+{
+    bspFile_t bsp;
+    if (!openBsp(entry, &bsp)) {
+        return false;
+    }
+
+    int numtexinfo;
+    texinfo_t *texinfo = (texinfo_t *)loadBspLump(&bsp, LUMP_TEXINFO, sizeof(texinfo_t), &numtexinfo);
+    if (texinfo == NULL) {
+        return false;
+    }
+
+    std::vector<dtexanim_t> anims(numtexinfo);
+    std::vector<int> frames;
+    for (int i = 0; i < numtexinfo; i++) {
+        anims[i].firstframe = LittleLong(int(frames.size()));
+        int count = 0;
+        int t = i;
+        do {
+            frames.push_back(LittleLong(t));
+            count++;
+            t = LittleLong(texinfo[t].nexttexinfo);
+        } while (t >= 0 && t < numtexinfo && t != i && count < MAX_ANIM_FRAMES);
+        anims[i].numframes = LittleLong(count);
+    }
+    free(texinfo);
+
+    dtexanimheader_t header;
+    header.ident = LittleLong(IDTEXANIMHEADER);
+    header.version = LittleLong(TEXANIM_VERSION);
+    header.numtexinfo = LittleLong(numtexinfo);
+    header.numframes = LittleLong(int(frames.size()));
+
+    char fullpath[1024];
+    if (!createOutputPath(outPath, entry.name, ".anims", fullpath, sizeof(fullpath))) {
+        return false;
+    }
+    FILE *f = fopen(fullpath, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", fullpath);
+        return false;
+    }
+    bool r = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(anims.data(), sizeof(dtexanim_t), anims.size(), f) == anims.size() &&
+        fwrite(frames.data(), sizeof(int), frames.size(), f) == frames.size();
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", fullpath);
+        return false;
+    }
+    return true;
+}
+
+bool exportAnimations(const char *outPath, bool sheets, const std::vector<bool>& selected)
+{
+    /* animname of every texture, read in parallel */
+    std::vector<const fileEntry *> wals;
+    for (const fileEntry& entry : entries) {
+        if (strncmp(entry.name, "textures/", 9) == 0 && hasExtension(entry.name, ".wal") &&
+            findEntry(entry.name) == &entry) {
+            wals.push_back(&entry);
+        }
+    }
+
+    std::vector<std::string> animnames(wals.size());
+    bool r = parallelFor(int(wals.size()), [&](int i) {
+        miptex_t mt;
+        if (!readEntry(*wals[i], 0, &mt, sizeof(mt))) {
+            return false;
+        }
+        animnames[i] = lowerName(mt.animname, strnlen(mt.animname, sizeof(mt.animname)));
+        return true;
+    });
+    if (!r) {
+        return false;
+    }
+
+    std::map<std::string, std::string> next;
+    std::set<std::string> targets;
+    for (size_t i = 0; i < wals.size(); i++) {
+        const char *name = wals[i]->name + 9;
+        next[lowerName(name, strlen(name) - 4)] = animnames[i];
+        targets.insert(animnames[i]);
+    }
+
+    std::map<std::string, std::vector<std::string> > chains;
+    std::vector<std::vector<std::string> > strips;
+    for (std::map<std::string, std::string>::const_iterator it = next.begin(); it != next.end(); ++it) {
+        if (it->second.empty()) {
+            continue;
+        }
+        std::vector<std::string> frames = walChain(next, it->first);
+        chains[it->first] = frames;
+
+        /* one strip per animation: from the first name of a loop or
+           from the head of a chain that does not loop */
+        std::map<std::string, std::string>::const_iterator last = next.find(frames.back());
+        bool loops = last != next.end() && last->second == frames[0];
+        bool owner = loops ? it->first == *std::min_element(frames.begin(), frames.end())
+                           : targets.count(it->first) == 0;
+        if (owner && frames.size() > 1) {
+            strips.push_back(frames);
+        }
+    }
+
+    r = writeAnimationsJson(outPath, chains);
+    if (r && sheets) {
+        lookupEntry(""); /* build the index before the workers use it */
+        r = parallelFor(int(strips.size()), [&](int i) {
+            return writeSheet(outPath, strips[i]);
+        });
+    }
+
+    std::vector<const fileEntry *> maps;
+    findSelectedMaps(selected, maps);
+    if (r) {
+        r = parallelFor(int(maps.size()), [&](int i) {
+            return exportTexinfoAnimations(*maps[i], outPath);
+        });
+    }
+
+    printf("Animations: %lu animated textures, %lu maps\n", chains.size(), maps.size());
+    return r;
+}
@@ -0,0 +1,62 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Texture animation chains
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_ANIMATIONS_H
+#define Q2UNPACK_ANIMATIONS_H
+
+#include "common.h"
+
+/* Binary texinfo animation table written per map: header, one
+ * dtexanim_t per texinfo and the frames they refer to. The frames of
+ * a texinfo start with the texinfo itself and follow nexttexinfo, so
+ * frame n of the animation is frames[firstframe + n % numframes]. */
+
+#define IDTEXANIMHEADER (('M' << 24) + ('N' << 16) + ('A' << 8) + 'Q') /* little-endian "QANM" */
+#define TEXANIM_VERSION 1
+
+typedef struct
+{
+    int ident;
+    int version;
+    int numtexinfo;
+    int numframes;
+} dtexanimheader_t;
+
+typedef struct
+{
+    int firstframe;
+    int numframes;
+} dtexanim_t;
+
+/*
+ * Resolve the WAL animname chains to textures/animations.json and the
+ * texinfo chains of every selected map to maps/<name>.anims. With sheets, each
+ * animation is also written as a horizontal strip of its frames to
+ * textures/<first frame>.anim.png, which needs the palette.
+ */
+bool exportAnimations(const char *outPath, bool sheets, const std::vector<bool>& selected);
+
+#endif
@@ -0,0 +1,263 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <cfloat>
+#include "bsp.h"
+#include "areas.h"
+
+typedef struct
+{
+    std::vector<dareanode_t> areas;
+    std::vector<dareaedge_t> edges;
+    std::vector<dareaportalinfo_t> portals;
+    int numcomponents;
+} areaGraph_t;
+
+static int findRoot(std::vector<int>& parent, int a)
+{
+    while (parent[a] != a) {
+        parent[a] = parent[parent[a]];
+        a = parent[a];
+    }
+    return a;
+}
+
+/*
+ * Label the connected areas, skipping one portal (-1 for none).
+ * Returns the number of components, area 0 not counted.
+ */
+static int areaComponents(const areaGraph_t& graph, int closedportal, std::vector<int> *labels)
+{
+    int numareas = int(graph.areas.size());
+    std::vector<int> parent(numareas);
+    for (int i = 0; i < numareas; i++) {
+        parent[i] = i;
+    }
+
+    for (const dareaportalinfo_t& p : graph.portals) {
+        if (p.portalnum == closedportal) {
+            continue;
+        }
+        int a = findRoot(parent, p.area[0]);
+        int b = findRoot(parent, p.area[1]);
+        if (a != b) {
+            parent[a] = b;
+        }
+    }
+
+    std::vector<int> component(numareas, -1);
+    int count = 0;
+    for (int i = 1; i < numareas; i++) {
+        int root = findRoot(parent, i);
+        if (component[root] < 0) {
+            component[root] = count++;
+        }
+        if (labels) {
+            (*labels)[i] = component[root];
+        }
+    }
+    return count;
+}
+
+static bool buildAreaGraph(const fileEntry& entry, areaGraph_t *graph)
+{
+    bspFile_t bsp;
+    if (!openBsp(entry, &bsp)) {
+        return false;
+    }
+
+    int numareas, numareaportals, numleafs;
+    darea_t *areas = (darea_t *)loadBspLump(&bsp, LUMP_AREAS, sizeof(darea_t), &numareas);
+    dareaportal_t *areaportals = (dareaportal_t *)loadBspLump(&bsp, LUMP_AREAPORTALS,
+        sizeof(dareaportal_t), &numareaportals);
+    dleaf_t *leafs = (dleaf_t *)loadBspLump(&bsp, LUMP_LEAFS, sizeof(dleaf_t), &numleafs);
+
+    bool r = areas && areaportals && leafs;
+    if (r && (numareas > MAX_MAP_AREAS || numareaportals > MAX_MAP_AREAPORTALS)) {
+        fprintf(stderr, "Too many areas in %s\n", entry.name);
+        r = false;
+    }
+
+    if (r) {
+        graph->areas.resize(numareas);
+        for (int i = 0; i < numareas && r; i++) {
+            dareanode_t *a = &graph->areas[i];
+            a->numleafs = 0;
+            for (int j = 0; j < 3; j++) {
+                a->mins[j] = FLT_MAX;
+                a->maxs[j] = -FLT_MAX;
+            }
+            a->firstedge = LittleLong(areas[i].firstareaportal);
+            a->numedges = LittleLong(areas[i].numareaportals);
+            a->component = -1;
+            if (a->firstedge < 0 || a->numedges < 0 || a->firstedge + a->numedges > numareaportals) {
+                fprintf(stderr, "Bad area %d in %s\n", i, entry.name);
+                r = false;
+            }
+        }
+
+        graph->edges.resize(numareaportals);
+        for (int i = 0; i < numareaportals && r; i++) {
+            graph->edges[i].otherarea = LittleLong(areaportals[i].otherarea);
+            graph->edges[i].portalnum = LittleLong(areaportals[i].portalnum);
+            if (graph->edges[i].otherarea < 0 || graph->edges[i].otherarea >= numareas) {
+                fprintf(stderr, "Bad area portal %d in %s\n", i, entry.name);
+                r = false;
+            }
+        }
+    }
+
+    if (r) {
+        for (int i = 0; i < numleafs; i++) {
+            int area = leafs[i].area;
+            if (area <= 0 || area >= numareas) {
+                continue;
+            }
+            dareanode_t *a = &graph->areas[area];
+            a->numleafs++;
+            for (int j = 0; j < 3; j++) {
+                if (leafs[i].mins[j] < a->mins[j]) {
+                    a->mins[j] = leafs[i].mins[j];
+                }
+                if (leafs[i].maxs[j] > a->maxs[j]) {
+                    a->maxs[j] = leafs[i].maxs[j];
+                }
+            }
+        }
+        for (dareanode_t& a : graph->areas) {
+            if (a.numleafs == 0) {
+                memset(a.mins, 0, sizeof(a.mins));
+                memset(a.maxs, 0, sizeof(a.maxs));
+            }
+        }
+
+        /* every portal is listed from both sides, keep one record */
+        for (int i = 1; i < numareas; i++) {
+            const dareanode_t *a = &graph->areas[i];
+            for (int j = 0; j < a->numedges; j++) {
+                const dareaedge_t *e = &graph->edges[a->firstedge + j];
+                if (e->otherarea > i) {
+                    dareaportalinfo_t p;
+                    p.portalnum = e->portalnum;
+                    p.area[0] = i;
+                    p.area[1] = e->otherarea;
+                    p.closedcomponents = 0;
+                    graph->portals.push_back(p);
+                }
+            }
+        }
+
+        std::vector<int> labels(numareas, -1);
+        graph->numcomponents = areaComponents(*graph, -1, &labels);
+        for (int i = 0; i < numareas; i++) {
+            graph->areas[i].component = labels[i];
+        }
+        for (dareaportalinfo_t& p : graph->portals) {
+            p.closedcomponents = areaComponents(*graph, p.portalnum, NULL);
+        }
+    }
+
+    free(areas);
+    free(areaportals);
+    free(leafs);
+    return r;
+}
+
+static bool writeAreaGraph(const char *path, const areaGraph_t& graph)
+{
+    dareaheader_t header;
+    header.ident = LittleLong(IDAREAHEADER);
+    header.version = LittleLong(AREAGRAPH_VERSION);
+    header.numareas = LittleLong(int(graph.areas.size()));
+    header.numedges = LittleLong(int(graph.edges.size()));
+    header.numportals = LittleLong(int(graph.portals.size()));
+    header.numcomponents = LittleLong(graph.numcomponents);
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return false;
+    }
+
+    bool r = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(graph.areas.data(), sizeof(dareanode_t), graph.areas.size(), f) == graph.areas.size() &&
+        fwrite(graph.edges.data(), sizeof(dareaedge_t), graph.edges.size(), f) == graph.edges.size() &&
+        fwrite(graph.portals.data(), sizeof(dareaportalinfo_t), graph.portals.size(), f) == graph.portals.size();
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+static bool writeAreaDot(const char *path, const char *name, const areaGraph_t& graph)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return false;
+    }
+
+    fprintf(f, "graph \"%s\" {\n", name);
+    for (size_t i = 1; i < graph.areas.size(); i++) {
+        const dareanode_t& a = graph.areas[i];
+        fprintf(f, "  a%lu [label=\"area %lu\\n%d leafs\\ncomponent %d\\n(%g %g %g) (%g %g %g)\"];\n",
+                i, i, a.numleafs, a.component, a.mins[0], a.mins[1], a.mins[2],
+                a.maxs[0], a.maxs[1], a.maxs[2]);
+    }
+    for (const dareaportalinfo_t& p : graph.portals) {
+        /* portals whose closing splits the map are drawn bold */
+        fprintf(f, "  a%d -- a%d [label=\"portal %d\"%s];\n", p.area[0], p.area[1], p.portalnum,
+                p.closedcomponents > graph.numcomponents ? ", style=bold" : "");
+    }
+    fputs("}\n", f);
+
+    bool r = !ferror(f);
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool exportAreas(const char *outPath, const std::vector<bool>& selected)
+{
+    std::vector<const fileEntry *> maps;
+    findSelectedMaps(selected, maps);
+
+    bool r = parallelFor(int(maps.size()), [&](int i) {
+        const fileEntry& entry = *maps[i];
+        areaGraph_t graph;
+        if (!buildAreaGraph(entry, &graph)) {
+            return false;
+        }
+
+        char fullpath[1024];
+        return createOutputPath(outPath, entry.name, ".areas", fullpath, sizeof(fullpath)) &&
+            writeAreaGraph(fullpath, graph) &&
+            createOutputPath(outPath, entry.name, ".areas.dot", fullpath, sizeof(fullpath)) &&
+            writeAreaDot(fullpath, entry.name, graph);
+    });
+
+    printf("Area graphs: %lu maps\n", maps.size());
+    return r;
+}
@@ -0,0 +1,77 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Area and areaportal graph export
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_AREAS_H
+#define Q2UNPACK_AREAS_H
+
+#include "common.h"
+
+/* Binary area graph: header, areas, the adjacency lists the areas
+ * refer to and one record per portal. Area 0 is the unused area of
+ * the BSP and is kept so area numbers match the leafs. */
+
+#define IDAREAHEADER (('E' << 24) + ('R' << 16) + ('A' << 8) + 'Q') /* little-endian "QARE" */
+#define AREAGRAPH_VERSION 1
+
+typedef struct
+{
+    int ident;
+    int version;
+    int numareas;
+    int numedges;
+    int numportals;
+    int numcomponents; /* with every portal open */
+} dareaheader_t;
+
+typedef struct
+{
+    int numleafs;
+    float mins[3], maxs[3]; /* bounds of the leafs in the area */
+    int firstedge;
+    int numedges;
+    int component;          /* with every portal open */
+} dareanode_t;
+
+typedef struct
+{
+    int otherarea;
+    int portalnum;
+} dareaedge_t;
+
+typedef struct
+{
+    int portalnum;
+    int area[2];
+    int closedcomponents; /* components with only this portal closed */
+} dareaportalinfo_t;
+
+/*
+ * Write the area graph of every selected map next to the extracted BSP,
+ * both as a binary table and as a DOT graph.
+ */
+bool exportAreas(const char *outPath, const std::vector<bool>& selected);
+
+#endif
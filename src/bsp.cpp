@@ -0,0 +1,94 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include "bsp.h"
+
+bool openBsp(const fileEntry& entry, bspFile_t *bsp)
+{
+    bsp->entry = &entry;
+    if (entry.length < long(sizeof(dheader_t)) ||
+        !readEntry(entry, 0, &bsp->header, sizeof(dheader_t))) {
+        fprintf(stderr, "Failed to read bsp header %s\n", entry.name);
+        return false;
+    }
+
+    if (LittleLong(bsp->header.ident) != IDBSPHEADER ||
+        LittleLong(bsp->header.version) != BSPVERSION) {
+        fprintf(stderr, "Bad bsp file %s\n", entry.name);
+        return false;
+    }
+
+    for (int i = 0; i < HEADER_LUMPS; i++) {
+        lump_t *l = &bsp->header.lumps[i];
+        l->fileofs = LittleLong(l->fileofs);
+        l->filelen = LittleLong(l->filelen);
+        if (l->fileofs < 0 || l->filelen < 0 ||
+            long(l->fileofs) + l->filelen > entry.length) {
+            fprintf(stderr, "Bad lump %d in %s\n", i, entry.name);
+            return false;
+        }
+    }
+    return true;
+}
+
+void *loadBspLump(const bspFile_t *bsp, int lump, int elemSize, int *count)
+{
+    const lump_t *l = &bsp->header.lumps[lump];
+    if (l->filelen % elemSize) {
+        fprintf(stderr, "Funny lump %d size in %s\n", lump, bsp->entry->name);
+        return NULL;
+    }
+
+    byte *data = (byte *)malloc(l->filelen + 1);
+    if (data == NULL) {
+        fprintf(stderr, "Out of memory loading lump %d of %s\n", lump, bsp->entry->name);
+        return NULL;
+    }
+    if (!readEntry(*bsp->entry, l->fileofs, data, l->filelen)) {
+        free(data);
+        return NULL;
+    }
+    data[l->filelen] = 0;
+    *count = l->filelen / elemSize;
+    return data;
+}
+
+void findMaps(std::vector<const fileEntry *>& maps)
+{
+    for (const fileEntry& entry : entries) {
+        if (strncmp(entry.name, "maps/", 5) == 0 && hasExtension(entry.name, ".bsp") &&
+            findEntry(entry.name) == &entry) {
+            maps.push_back(&entry);
+        }
+    }
+}
+
+void findSelectedMaps(const std::vector<bool>& selected, std::vector<const fileEntry *>& maps)
+{
+    std::vector<const fileEntry *> found;
+    findMaps(found);
+    for (const fileEntry *map : found) {
+        if (selected[map - entries.data()]) {
+            maps.push_back(map);
+        }
+    }
+}
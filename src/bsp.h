@@ -0,0 +1,62 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Lump level access to BSP files inside the entry table
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_BSP_H
+#define Q2UNPACK_BSP_H
+
+#include "common.h"
+
+typedef struct
+{
+    const fileEntry *entry;
+    dheader_t header;
+} bspFile_t;
+
+/*
+ * Read and validate the header of a BSP entry.
+ */
+bool openBsp(const fileEntry& entry, bspFile_t *bsp);
+
+/*
+ * Load a single lump to a malloc'd buffer. The lump length must be a
+ * multiple of elemSize; the element count is returned in count. The
+ * buffer has one extra zero byte at the end so text lumps are
+ * terminated. Returns NULL on failure.
+ */
+void *loadBspLump(const bspFile_t *bsp, int lump, int elemSize, int *count);
+
+/*
+ * Collect the .bsp entries under maps/, skipping names shadowed by an
+ * earlier entry, in entry table order.
+ */
+void findMaps(std::vector<const fileEntry *>& maps);
+
+/*
+ * Like findMaps, keeping only the selected maps.
+ */
+void findSelectedMaps(const std::vector<bool>& selected, std::vector<const fileEntry *>& maps);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "checksum.h"
+#include "cache.h"
+
+typedef struct
+{
+    std::string path;
+    long maxBytes;
+    std::atomic<long> size; /* estimate, exact after a trim */
+    std::atomic<long> hits;
+    std::atomic<long> misses;
+    std::atomic<long> evicted;
+    std::mutex trimLock;
+} conversionCache_t;
+
+static conversionCache_t *cache = NULL;
+
+typedef struct
+{
+    time_t used;
+    long size;
+    std::string path;
+} cacheFile_t;
+
+static bool usedBefore(const cacheFile_t& a, const cacheFile_t& b)
+{
+    return a.used < b.used;
+}
+
+/*
+ * Measure the cache and, when it is over the limit, remove the least
+ * recently used results until it is a tenth under it.
+ */
+static void trimCache()
+{
+    std::lock_guard<std::mutex> lock(cache->trimLock);
+    std::vector<cacheFile_t> files;
+    long total = 0;
+    DIR *dir = opendir(cache->path.c_str());
+    if (dir == NULL) {
+        return;
+    }
+    dirent *dp;
+    while ((dp = readdir(dir)) != NULL) {
+        if (dp->d_name[0] == '.' || strlen(dp->d_name) != 2) {
+            continue;
+        }
+        std::string sub = cache->path + "/" + dp->d_name;
+        DIR *subdir = opendir(sub.c_str());
+        if (subdir == NULL) {
+            continue;
+        }
+        dirent *fp;
+        while ((fp = readdir(subdir)) != NULL) {
+            /* names with a dot are files still being written */
+            cacheFile_t file;
+            file.path = sub + "/" + fp->d_name;
+            struct stat st;
+            if (strchr(fp->d_name, '.') != NULL || stat(file.path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+            file.used = st.st_mtime;
+            file.size = long(st.st_size);
+            total += file.size;
+            files.push_back(file);
+        }
+        closedir(subdir);
+    }
+    closedir(dir);
+
+    if (total > cache->maxBytes) {
+        std::sort(files.begin(), files.end(), usedBefore);
+        long target = cache->maxBytes - cache->maxBytes / 10;
+        for (size_t i = 0; i < files.size() && total > target; i++) {
+            /* another process may have removed it already */
+            if (unlink(files[i].path.c_str()) == 0 || errno == ENOENT) {
+                total -= files[i].size;
+                cache->evicted++;
+            }
+        }
+    }
+    cache->size = total;
+}
+
+static std::string cachePath(uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%02x/%014llx", unsigned(key >> 56),
+             (unsigned long long)(key & 0xffffffffffffffULL));
+    return cache->path + name;
+}
+
+bool openCache(const char *path, long maxBytes)
+{
+    mkdir(path, 0777);
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "Cannot use %s as a cache\n", path);
+        return false;
+    }
+    cache = new conversionCache_t;
+    cache->path = path;
+    cache->maxBytes = maxBytes;
+    cache->size = 0;
+    cache->hits = cache->misses = cache->evicted = 0;
+    trimCache();
+    return true;
+}
+
+bool cacheEnabled()
+{
+    return cache != NULL;
+}
+
+uint64_t cacheKey(const void *input, size_t length, const char *options)
+{
+    char key[256];
+    int l = snprintf(key, sizeof(key), "%016llx %016llx %d %s",
+                     (unsigned long long)xxh64(input, length, 0),
+                     (unsigned long long)xxh64(d_8to24table, sizeof(d_8to24table), 0), CACHE_VERSION, options);
+    return xxh64(key, size_t(l), 0);
+}
+
+bool cacheLookup(uint64_t key, std::vector<byte>& data)
+{
+    std::string path = cachePath(key);
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        cache->misses++;
+        return false;
+    }
+    data.resize(size_t(st.st_size));
+    bool r = pread(fd, data.data(), data.size(), 0) == ssize_t(data.size());
+    /* the modification time is the last use, atime may not be kept */
+    futimens(fd, NULL);
+    close(fd);
+    if (!r) {
+        cache->misses++;
+        return false;
+    }
+    cache->hits++;
+    return true;
+}
+
+void cacheStore(uint64_t key, const std::vector<byte>& data)
+{
+    std::string path = cachePath(key);
+    mkdir(path.substr(0, path.rfind('/')).c_str(), 0777);
+
+    /* written aside and renamed, so readers never see a partial file */
+    std::string temp = tempPath(path);
+    FILE *f = fopen(temp.c_str(), "wb");
+    if (!f) {
+        return;
+    }
+    bool r = fwrite(data.data(), 1, data.size(), f) == data.size();
+    if (fclose(f) != 0 || !r || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        return;
+    }
+
+    if ((cache->size += long(data.size())) > cache->maxBytes) {
+        trimCache();
+    }
+}
+
+void reportCache()
+{
+    if (cache == NULL) {
+        return;
+    }
+    printf("Cache: %ld hits, %ld misses, %ld evicted, %ld bytes\n", long(cache->hits), long(cache->misses),
+           long(cache->evicted), long(cache->size));
+}
@@ -0,0 +1,73 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Persistent cache of converted files
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_CACHE_H
+#define Q2UNPACK_CACHE_H
+
+#include "common.h"
+
+/* Bump when a converter changes its output, the old results are then
+ * never hit again and age out. */
+#define CACHE_VERSION 1
+
+/* Default size limit in megabytes */
+#define CACHE_DEFAULT_SIZE 1024
+
+/*
+ * Use the cache directory, creating it if needed. Files used least
+ * recently are removed once it grows past maxBytes. Several processes,
+ * also on different machines, may share the directory.
+ */
+bool openCache(const char *path, long maxBytes);
+
+/*
+ * Whether openCache was called.
+ */
+bool cacheEnabled();
+
+/*
+ * Key of a conversion: the input, the palette, CACHE_VERSION and the
+ * options the converter was given.
+ */
+uint64_t cacheKey(const void *input, size_t length, const char *options);
+
+/*
+ * Get a cached result, marking it used.
+ */
+bool cacheLookup(uint64_t key, std::vector<byte>& data);
+
+/*
+ * Add a result. Failing to write is not an error, the result is only
+ * not cached.
+ */
+void cacheStore(uint64_t key, const std::vector<byte>& data);
+
+/*
+ * Print the hits and misses of this run.
+ */
+void reportCache();
+
+#endif
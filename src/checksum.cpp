@@ -0,0 +1,349 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_SSE42
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM
+#endif
+#include "checksum.h"
+
+#define CRC32C_POLY 0x82f63b78 /* reversed Castagnoli */
+
+typedef struct crc32cTable_s
+{
+    uint32_t table[256];
+
+    crc32cTable_s()
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int j = 0; j < 8; j++) {
+                c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+            }
+            table[i] = c;
+        }
+    }
+} crc32cTable_t;
+
+static uint32_t crc32cSoftware(uint32_t crc, const byte *p, size_t length)
+{
+    static const crc32cTable_t crcTable;
+    for (size_t i = 0; i < length; i++) {
+        crc = crcTable.table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(CRC32C_SSE42)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const byte *p, size_t length)
+{
+    uint64_t c = crc;
+    for (; length >= 8; length -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    uint32_t c32 = uint32_t(c);
+    for (; length > 0; length--, p++) {
+        c32 = _mm_crc32_u8(c32, *p);
+    }
+    return c32;
+}
+
+static bool hasHardwareCrc()
+{
+    static const bool sse42 = __builtin_cpu_supports("sse4.2");
+    return sse42;
+}
+#elif defined(CRC32C_ARM)
+static uint32_t crc32cHardware(uint32_t crc, const byte *p, size_t length)
+{
+    for (; length >= 8; length -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+    }
+    for (; length > 0; length--, p++) {
+        crc = __crc32cb(crc, *p);
+    }
+    return crc;
+}
+
+static bool hasHardwareCrc()
+{
+    return true;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t length)
+{
+    crc = ~crc;
+#if defined(CRC32C_SSE42) || defined(CRC32C_ARM)
+    if (hasHardwareCrc()) {
+        return ~crc32cHardware(crc, (const byte *)data, length);
+    }
+#endif
+    return ~crc32cSoftware(crc, (const byte *)data, length);
+}
+
+#define XXH_PRIME1 11400714785074694791ULL
+#define XXH_PRIME2 14029467366897019727ULL
+#define XXH_PRIME3 1609587929392839161ULL
+#define XXH_PRIME4 9650029242287828579ULL
+#define XXH_PRIME5 2870177450012600261ULL
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const byte *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v; /* little endian hosts only, like the rest */
+}
+
+static inline uint32_t read32(const byte *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t xxhRound(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME1;
+}
+
+static inline uint64_t xxhMerge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxhRound(0, val);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+uint64_t xxh64(const void *data, size_t length, uint64_t seed)
+{
+    const byte *p = (const byte *)data;
+    const byte *end = p + length;
+    uint64_t h;
+
+    if (length >= 32) {
+        uint64_t v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+        uint64_t v2 = seed + XXH_PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = xxhRound(v1, read64(p));
+            v2 = xxhRound(v2, read64(p + 8));
+            v3 = xxhRound(v3, read64(p + 16));
+            v4 = xxhRound(v4, read64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxhMerge(h, v1);
+        h = xxhMerge(h, v2);
+        h = xxhMerge(h, v3);
+        h = xxhMerge(h, v4);
+    } else {
+        h = seed + XXH_PRIME5;
+    }
+
+    h += length;
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxhRound(0, read64(p));
+        h = rotl64(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+    }
+    if (p + 4 <= end) {
+        h ^= uint64_t(read32(p)) * XXH_PRIME1;
+        h = rotl64(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * XXH_PRIME5;
+        h = rotl64(h, 11) * XXH_PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+typedef struct
+{
+    std::string name;
+    uint32_t crc;
+    uint64_t hash;
+    long length;
+} checksumRecord_t;
+
+static bool recordLess(const checksumRecord_t& a, const checksumRecord_t& b)
+{
+    return a.name < b.name;
+}
+
+/*
+ * Unpack and hash every file of the source, dropping the ones it leaves out.
+ */
+static bool hashFiles(int count, const checksumSource_t& source, std::vector<checksumRecord_t>& records)
+{
+    records.assign(count, checksumRecord_t());
+    bool r = parallelFor(count, [&](int i) {
+        std::vector<byte> data;
+        checksumRecord_t& record = records[i];
+        if (!source(i, record.name, data)) {
+            return false;
+        }
+        record.crc = crc32c(0, data.data(), data.size());
+        record.hash = xxh64(data.data(), data.size(), 0);
+        record.length = long(data.size());
+        return true;
+    });
+    if (!r) {
+        return false;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        if (!records[i].name.empty()) {
+            records[n++] = records[i];
+        }
+    }
+    records.resize(n);
+    return true;
+}
+
+bool writeChecksums(const char *path, int count, const checksumSource_t& source)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<checksumRecord_t> records;
+    if (!hashFiles(count, source, records)) {
+        return false;
+    }
+    std::sort(records.begin(), records.end(), recordLess);
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return false;
+    }
+    long total = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        fprintf(f, "%08x %016llx %ld %s\n", records[i].crc, (unsigned long long)records[i].hash, records[i].length,
+                records[i].name.c_str());
+        total += records[i].length;
+    }
+    bool r = !ferror(f);
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return false;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Checksums: %lu files, %ld bytes in %.3f s (%.1f MB/s)\n", records.size(), total, seconds,
+           seconds > 0 ? total / seconds / (1024 * 1024) : 0.0);
+    return true;
+}
+
+bool verifyChecksums(const char *path, int count, const checksumSource_t& source)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+
+    typedef struct
+    {
+        uint32_t crc;
+        uint64_t hash;
+        long length;
+        std::string name;
+    } manifestLine_t;
+
+    std::vector<manifestLine_t> lines;
+    char line[1024];
+    int lineno = 0;
+    bool r = true;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        manifestLine_t m;
+        unsigned crc;
+        unsigned long long hash;
+        int n = 0;
+        line[strcspn(line, "\r\n")] = 0;
+        if (sscanf(line, "%8x %16llx %ld %n", &crc, &hash, &m.length, &n) != 3 || line[n] == 0) {
+            fprintf(stderr, "Bad line %d in %s\n", lineno, path);
+            r = false;
+            break;
+        }
+        m.crc = crc;
+        m.hash = hash;
+        m.name = line + n;
+        lines.push_back(m);
+    }
+    fclose(f);
+    if (!r) {
+        return false;
+    }
+
+    std::vector<checksumRecord_t> records;
+    if (!hashFiles(count, source, records)) {
+        return false;
+    }
+    /* first one wins, the names may only differ in case */
+    std::unordered_map<std::string, int> index;
+    for (size_t i = 0; i < records.size(); i++) {
+        index.insert(std::make_pair(lowerName(records[i].name.c_str()), int(i)));
+    }
+
+    int missing = 0, mismatched = 0, checked = 0;
+    for (size_t i = 0; i < lines.size(); i++) {
+        const manifestLine_t& m = lines[i];
+        std::unordered_map<std::string, int>::const_iterator it = index.find(lowerName(m.name.c_str()));
+        if (it == index.end()) {
+            fprintf(stderr, "Missing %s\n", m.name.c_str());
+            missing++;
+            continue;
+        }
+        const checksumRecord_t& record = records[it->second];
+        checked++;
+        if (record.length != m.length || record.crc != m.crc || record.hash != m.hash) {
+            fprintf(stderr, "Mismatch %s\n", m.name.c_str());
+            mismatched++;
+        }
+    }
+
+    printf("Verify: %d ok, %d mismatched, %d missing\n", checked - mismatched, mismatched, missing);
+    return mismatched == 0 && missing == 0;
+}
@@ -0,0 +1,66 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Checksum manifests
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_CHECKSUM_H
+#define Q2UNPACK_CHECKSUM_H
+
+#include <string>
+#include "common.h"
+
+/* A manifest has one line per file, sorted by name:
+ * "<crc32c, 8 hex digits> <xxh64, 16 hex digits> <length> <name>" */
+
+/*
+ * CRC32C (Castagnoli), with the SSE 4.2 or ARMv8 CRC instructions when
+ * the CPU has them. Pass 0 to start.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t length);
+
+/*
+ * 64 bit xxHash of a buffer.
+ */
+uint64_t xxh64(const void *data, size_t length, uint64_t seed);
+
+/*
+ * Unpacks file index of a manifest, giving the name it is written as,
+ * empty to leave it out, and its bytes.
+ */
+typedef std::function<bool(int index, std::string& name, std::vector<byte>& data)> checksumSource_t;
+
+/*
+ * Write the manifest of the count files of a source, hashing them in
+ * parallel.
+ */
+bool writeChecksums(const char *path, int count, const checksumSource_t& source);
+
+/*
+ * Check the files of a source against a manifest, reporting missing and
+ * mismatching files. Names are compared case insensitively since the
+ * unpacked files are lowercased.
+ */
+bool verifyChecksums(const char *path, int count, const checksumSource_t& source);
+
+#endif
@@ -0,0 +1,358 @@
+/*
+* Copyright (C) 1997-2001 Id Software, Inc.
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include "cin.h"
+
+/* Same limits as the client */
+#define MAX_CIN_SIZE 4096
+#define MAX_CIN_COMPRESSED 0x20000
+
+typedef struct
+{
+    int hnodes[256 * 256 * 2]; /* [prev][node - 256][bit] */
+    int numhnodes[256];        /* root node of each tree */
+} cinHuffman_t;
+
+/* Where a frame is inside the entry */
+typedef struct
+{
+    long offset; /* of the compressed data */
+    int size;
+    int palette; /* index to the palettes seen before the frame */
+} cinFrame_t;
+
+static int smallestNode(int *counts, bool *used, int numhnodes)
+{
+    int best = 99999999;
+    int bestnode = -1;
+    for (int i = 0; i < numhnodes; i++) {
+        if (used[i] || !counts[i]) {
+            continue;
+        }
+        if (counts[i] < best) {
+            best = counts[i];
+            bestnode = i;
+        }
+    }
+    if (bestnode == -1) {
+        return -1;
+    }
+    used[bestnode] = true;
+    return bestnode;
+}
+
+/*
+ * Build the 256 trees from the counts like Huff1TableInit.
+ */
+static void buildHuffman(const byte *counts, cinHuffman_t *huff)
+{
+    for (int prev = 0; prev < 256; prev++) {
+        int count[512];
+        bool used[512];
+        memset(count, 0, sizeof(count));
+        memset(used, 0, sizeof(used));
+        for (int j = 0; j < 256; j++) {
+            count[j] = counts[prev * 256 + j];
+        }
+
+        int numhnodes = 256;
+        int *nodebase = huff->hnodes + prev * 256 * 2;
+        while (numhnodes != 511) {
+            int *node = nodebase + (numhnodes - 256) * 2;
+            node[0] = smallestNode(count, used, numhnodes);
+            if (node[0] == -1) {
+                break;
+            }
+            node[1] = smallestNode(count, used, numhnodes);
+            if (node[1] == -1) {
+                break;
+            }
+            count[numhnodes] = count[node[0]] + count[node[1]];
+            numhnodes++;
+        }
+        huff->numhnodes[prev] = numhnodes - 1;
+    }
+}
+
+/*
+ * Decompress one frame like Huff1Decompress, with bounds checks on
+ * the input and the tree since the data comes from a file.
+ */
+static bool decompressFrame(const cinHuffman_t *huff, const byte *in, int insize, byte *out, int outsize)
+{
+    if (insize < 4) {
+        return false;
+    }
+    int count = in[0] | (in[1] << 8) | (in[2] << 16) | (in[3] << 24);
+    if (count != outsize) {
+        return false;
+    }
+
+    const byte *input = in + 4;
+    const byte *end = in + insize;
+    const int *hnodes = huff->hnodes - 256 * 2; /* nodes 0-255 are leafs */
+    int nodenum = huff->numhnodes[0];
+    while (count) {
+        /* the last code is emitted on the next bit, which may be one
+           byte past the data */
+        if (input > end) {
+            return false;
+        }
+        int inbyte = input < end ? *input : 0;
+        input++;
+        for (int bit = 0; bit < 8; bit++) {
+            if (nodenum < 256) {
+                hnodes = huff->hnodes + (nodenum << 9) - 256 * 2;
+                *out++ = byte(nodenum);
+                if (!--count) {
+                    break;
+                }
+                nodenum = huff->numhnodes[nodenum];
+            }
+            nodenum = hnodes[nodenum * 2 + (inbyte & 1)];
+            if (nodenum < 0 || nodenum >= 511) {
+                return false;
+            }
+            inbyte >>= 1;
+        }
+    }
+    return true;
+}
+
+static void putLittleLong(byte *p, int v)
+{
+    p[0] = byte(v);
+    p[1] = byte(v >> 8);
+    p[2] = byte(v >> 16);
+    p[3] = byte(v >> 24);
+}
+
+/*
+ * Plain 44 byte PCM WAV header.
+ */
+static void wavHeader(byte *h, const dcinheader_t *cin, int datalen)
+{
+    memcpy(h, "RIFF", 4);
+    putLittleLong(h + 4, 36 + datalen);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    putLittleLong(h + 16, 16);
+    h[20] = 1;
+    h[21] = 0;
+    h[22] = byte(cin->s_channels);
+    h[23] = 0;
+    putLittleLong(h + 24, cin->s_rate);
+    putLittleLong(h + 28, cin->s_rate * cin->s_width * cin->s_channels);
+    h[32] = byte(cin->s_width * cin->s_channels);
+    h[33] = 0;
+    h[34] = byte(cin->s_width * 8);
+    h[35] = 0;
+    memcpy(h + 36, "data", 4);
+    putLittleLong(h + 40, datalen);
+}
+
+/*
+ * Walk the frame headers, copying the audio to the WAV as it goes by.
+ * Only the small headers and the audio are read here.
+ */
+static bool scanFrames(const fileEntry& entry, const dcinheader_t *cin, FILE *wav,
+                       std::vector<cinFrame_t>& frames, std::vector<byte>& palettes)
+{
+    long pos = sizeof(dcinheader_t) + 256 * 256;
+    int samplesize = cin->s_width * cin->s_channels;
+    std::vector<byte> audio;
+    int datalen = 0;
+
+    for (;;) {
+        int command;
+        if (pos + 4 > entry.length || !readEntry(entry, pos, &command, 4)) {
+            break; /* some files end without CIN_END */
+        }
+        command = LittleLong(command);
+        pos += 4;
+        if (command == CIN_END) {
+            break;
+        }
+        if (command == CIN_PALETTE) {
+            size_t n = palettes.size();
+            palettes.resize(n + 768);
+            if (!readEntry(entry, pos, &palettes[n], 768)) {
+                return false;
+            }
+            pos += 768;
+        } else if (command != CIN_FRAME) {
+            fprintf(stderr, "Bad command %d in %s\n", command, entry.name);
+            return false;
+        }
+
+        cinFrame_t frame;
+        if (!readEntry(entry, pos, &frame.size, 4)) {
+            return false;
+        }
+        frame.size = LittleLong(frame.size);
+        if (frame.size < 4 || frame.size > MAX_CIN_COMPRESSED || pos + 4 + frame.size > entry.length) {
+            fprintf(stderr, "Bad frame size %d in %s\n", frame.size, entry.name);
+            return false;
+        }
+        frame.offset = pos + 4;
+        frame.palette = int(palettes.size() / 768) - 1;
+        pos = frame.offset + frame.size;
+
+        /* audio of this frame, rounded like SCR_ReadNextFrame */
+        long n = long(frames.size());
+        int start = int(n * cin->s_rate / CIN_FPS);
+        int end = int((n + 1) * cin->s_rate / CIN_FPS);
+        int len = (end - start) * samplesize;
+        frames.push_back(frame);
+        if (len > 0) {
+            audio.resize(len);
+            if (pos + len > entry.length || !readEntry(entry, pos, audio.data(), len)) {
+                fprintf(stderr, "Truncated audio in %s\n", entry.name);
+                return false;
+            }
+            if (fwrite(audio.data(), 1, len, wav) != size_t(len)) {
+                return false;
+            }
+            datalen += len;
+            pos += len;
+        }
+    }
+
+    byte header[44];
+    wavHeader(header, cin, datalen);
+    return fseek(wav, 0, SEEK_SET) == 0 && fwrite(header, sizeof(header), 1, wav) == 1;
+}
+
+static bool decodeCinematic(const fileEntry& entry, const char *outPath, int *numframes)
+{
+    dcinheader_t cin;
+    if (!readEntry(entry, 0, &cin, sizeof(cin))) {
+        return false;
+    }
+    cin.width = LittleLong(cin.width);
+    cin.height = LittleLong(cin.height);
+    cin.s_rate = LittleLong(cin.s_rate);
+    cin.s_width = LittleLong(cin.s_width);
+    cin.s_channels = LittleLong(cin.s_channels);
+    if (cin.width <= 0 || cin.height <= 0 || cin.width > MAX_CIN_SIZE || cin.height > MAX_CIN_SIZE ||
+        cin.s_rate < 0 || (cin.s_width != 1 && cin.s_width != 2) ||
+        (cin.s_channels != 1 && cin.s_channels != 2)) {
+        fprintf(stderr, "Bad cinematic %s\n", entry.name);
+        return false;
+    }
+
+    byte *counts = (byte *)malloc(256 * 256);
+    cinHuffman_t *huff = (cinHuffman_t *)malloc(sizeof(cinHuffman_t));
+    if (counts == NULL || huff == NULL || !readEntry(entry, sizeof(cin), counts, 256 * 256)) {
+        free(counts);
+        free(huff);
+        return false;
+    }
+    memset(huff, 0, sizeof(cinHuffman_t));
+    buildHuffman(counts, huff);
+    free(counts);
+
+    char fullpath[1024];
+    std::vector<cinFrame_t> frames;
+    std::vector<byte> palettes;
+    bool r = createOutputPath(outPath, entry.name, ".wav", fullpath, sizeof(fullpath));
+    if (r) {
+        FILE *wav = fopen(fullpath, "wb");
+        if (!wav) {
+            fprintf(stderr, "Failed to create %s\n", fullpath);
+            free(huff);
+            return false;
+        }
+        byte header[44];
+        wavHeader(header, &cin, 0);
+        r = fwrite(header, sizeof(header), 1, wav) == 1 && scanFrames(entry, &cin, wav, frames, palettes);
+        if (fclose(wav) != 0 || !r) {
+            fprintf(stderr, "Failed to write %s\n", fullpath);
+            r = false;
+        }
+    }
+
+    /* the frames only share the trees and the palettes, so they are
+       decoded independently */
+    if (r) {
+        r = parallelFor(int(frames.size()), [&](int i) {
+            const cinFrame_t& frame = frames[i];
+            int size = cin.width * cin.height;
+            std::vector<byte> compressed(frame.size);
+            std::vector<byte> pixels(size);
+            if (!readEntry(entry, frame.offset, compressed.data(), frame.size)) {
+                return false;
+            }
+            if (!decompressFrame(huff, compressed.data(), frame.size, pixels.data(), size)) {
+                fprintf(stderr, "Bad frame %d in %s\n", i, entry.name);
+                return false;
+            }
+
+            uint32_t palette[256];
+            for (int j = 0; j < 256; j++) {
+                if (frame.palette >= 0) {
+                    const byte *p = &palettes[frame.palette * 768 + j * 3];
+                    palette[j] = LittleLong((255u << 24) + (p[0] << 0) + (p[1] << 8) + (p[2] << 16));
+                } else {
+                    palette[j] = d_8to24table[j] | LittleLong(0xff000000);
+                }
+            }
+
+            std::vector<uint32_t> rgba(size);
+            for (int j = 0; j < size; j++) {
+                rgba[j] = palette[pixels[j]];
+            }
+
+            char framepath[1024];
+            char ext[32];
+            snprintf(ext, sizeof(ext), "/%04d.png", i);
+            return createOutputPath(outPath, entry.name, ext, framepath, sizeof(framepath)) &&
+                writePng(framepath, cin.width, cin.height, rgba.data());
+        });
+    }
+
+    free(huff);
+    *numframes = int(frames.size());
+    return r;
+}
+
+bool decodeCinematics(const char *outPath, const std::vector<bool>& selected)
+{
+    int videos = 0, total = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        const fileEntry& entry = entries[i];
+        if (!selected[i] || strncmp(entry.name, "video/", 6) != 0 || !hasExtension(entry.name, ".cin") ||
+            findEntry(entry.name) != &entry) {
+            continue;
+        }
+
+        int numframes = 0;
+        if (!decodeCinematic(entry, outPath, &numframes)) {
+            return false;
+        }
+        videos++;
+        total += numframes;
+    }
+
+    printf("Cinematics: %d videos, %d frames\n", videos, total);
+    return true;
+}
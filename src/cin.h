@@ -0,0 +1,58 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Quake 2 cinematic (.cin) decoding
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_CIN_H
+#define Q2UNPACK_CIN_H
+
+#include "common.h"
+
+/* A .cin file is this header, 256 rows of 256 byte counts for the
+ * Huffman trees (one tree per previous pixel value) and then frames
+ * until CIN_END. Each frame is a command, a palette for CIN_PALETTE,
+ * the compressed size and data, and 1/14 second of raw audio. */
+
+#define CIN_FRAME 0
+#define CIN_PALETTE 1
+#define CIN_END 2
+
+#define CIN_FPS 14
+
+typedef struct
+{
+    int width;
+    int height;
+    int s_rate;
+    int s_width;
+    int s_channels;
+} dcinheader_t;
+
+/*
+ * Decode every selected .cin entry under video/ to numbered PNG frames in
+ * video/<name>/ and its audio to video/<name>.wav.
+ */
+bool decodeCinematics(const char *outPath, const std::vector<bool>& selected);
+
+#endif
@@ -0,0 +1,634 @@
+/*
+* Copyright (C) 1997-2001 Id Software, Inc.
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include "bsp.h"
+#include "collision.h"
+
+/* 1/32 epsilon to keep floating point happy */
+#define DIST_EPSILON (0.03125f)
+
+#define DotProduct(x, y) ((x)[0] * (y)[0] + (x)[1] * (y)[1] + (x)[2] * (y)[2])
+
+/* Per thread state of a running trace. The brush check stamps live
+ * here instead of in the brushes so the map stays read only. */
+typedef struct
+{
+    const collisionMap_t *map;
+    std::vector<unsigned> checked;
+    unsigned checkcount;
+
+    trace_t trace;
+    float start[3], end[3];
+    float mins[3], maxs[3];
+    float extents[3];
+    int contents;
+    bool ispoint;
+} traceWork_t;
+
+static thread_local traceWork_t work;
+
+bool loadCollisionMap(const fileEntry& entry, collisionMap_t *map)
+{
+    bspFile_t bsp;
+    if (!openBsp(entry, &bsp)) {
+        return false;
+    }
+
+    int numplanes, numnodes, numleafs, numleafbrushes, numbrushes, numsides, numtexinfo, nummodels;
+    dplane_t *planes = (dplane_t *)loadBspLump(&bsp, LUMP_PLANES, sizeof(dplane_t), &numplanes);
+    dnode_t *nodes = (dnode_t *)loadBspLump(&bsp, LUMP_NODES, sizeof(dnode_t), &numnodes);
+    dleaf_t *leafs = (dleaf_t *)loadBspLump(&bsp, LUMP_LEAFS, sizeof(dleaf_t), &numleafs);
+    unsigned short *leafbrushes = (unsigned short *)loadBspLump(&bsp, LUMP_LEAFBRUSHES,
+        sizeof(unsigned short), &numleafbrushes);
+    dbrush_t *brushes = (dbrush_t *)loadBspLump(&bsp, LUMP_BRUSHES, sizeof(dbrush_t), &numbrushes);
+    dbrushside_t *sides = (dbrushside_t *)loadBspLump(&bsp, LUMP_BRUSHSIDES, sizeof(dbrushside_t), &numsides);
+    texinfo_t *texinfo = (texinfo_t *)loadBspLump(&bsp, LUMP_TEXINFO, sizeof(texinfo_t), &numtexinfo);
+    dmodel_t *models = (dmodel_t *)loadBspLump(&bsp, LUMP_MODELS, sizeof(dmodel_t), &nummodels);
+
+    bool r = planes && nodes && leafs && leafbrushes && brushes && sides && texinfo && models;
+    if (r && (numleafs < 1 || nummodels < 1)) {
+        fprintf(stderr, "Map %s has no leafs or models\n", entry.name);
+        r = false;
+    }
+
+    if (r) {
+        map->planes.resize(numplanes);
+        for (int i = 0; i < numplanes && r; i++) {
+            cplane_t *p = &map->planes[i];
+            memcpy(p->normal, planes[i].normal, sizeof(p->normal));
+            p->dist = planes[i].dist;
+            p->type = LittleLong(planes[i].type);
+            /* the traces index axes by the type */
+            if (p->type < PLANE_X || p->type > PLANE_ANYZ) {
+                fprintf(stderr, "Bad plane type in %s\n", entry.name);
+                r = false;
+            }
+        }
+    }
+
+    if (r) {
+        map->nodes.resize(numnodes);
+        for (int i = 0; i < numnodes && r; i++) {
+            int planenum = LittleLong(nodes[i].planenum);
+            cnode_t *n = &map->nodes[i];
+            if (planenum < 0 || planenum >= numplanes) {
+                fprintf(stderr, "Bad node plane in %s\n", entry.name);
+                r = false;
+                break;
+            }
+            const cplane_t *p = &map->planes[planenum];
+            memcpy(n->normal, p->normal, sizeof(n->normal));
+            n->dist = p->dist;
+            n->type = p->type;
+            if (n->type < 3 && n->normal[n->type] != 1.0f) {
+                n->type = PLANE_ANYX + n->type;
+            }
+            for (int j = 0; j < 2; j++) {
+                n->children[j] = LittleLong(nodes[i].children[j]);
+                int c = n->children[j];
+                if (c >= numnodes || (c < 0 && -1 - c >= numleafs)) {
+                    fprintf(stderr, "Bad node child in %s\n", entry.name);
+                    r = false;
+                }
+            }
+            n->pad = 0;
+        }
+    }
+
+    if (r) {
+        map->leafbrushes.resize(numleafbrushes);
+        for (int i = 0; i < numleafbrushes && r; i++) {
+            map->leafbrushes[i] = leafbrushes[i];
+            if (leafbrushes[i] >= numbrushes) {
+                fprintf(stderr, "Bad leaf brush in %s\n", entry.name);
+                r = false;
+            }
+        }
+
+        map->leafs.resize(numleafs);
+        for (int i = 0; i < numleafs && r; i++) {
+            cleaf_t *l = &map->leafs[i];
+            l->contents = LittleLong(leafs[i].contents);
+            l->cluster = leafs[i].cluster;
+            l->area = leafs[i].area;
+            l->firstleafbrush = leafs[i].firstleafbrush;
+            l->numleafbrushes = leafs[i].numleafbrushes;
+            if (l->firstleafbrush + l->numleafbrushes > numleafbrushes) {
+                fprintf(stderr, "Bad leaf brushes in %s\n", entry.name);
+                r = false;
+            }
+        }
+
+        map->brushes.resize(numbrushes);
+        for (int i = 0; i < numbrushes && r; i++) {
+            cbrush_t *b = &map->brushes[i];
+            b->contents = LittleLong(brushes[i].contents);
+            b->firstbrushside = LittleLong(brushes[i].firstside);
+            b->numsides = LittleLong(brushes[i].numsides);
+            if (b->firstbrushside < 0 || b->numsides < 0 || b->firstbrushside + b->numsides > numsides) {
+                fprintf(stderr, "Bad brush sides in %s\n", entry.name);
+                r = false;
+            }
+        }
+
+        map->brushsides.resize(numsides);
+        for (int i = 0; i < numsides && r; i++) {
+            cbrushside_t *s = &map->brushsides[i];
+            s->planenum = sides[i].planenum;
+            int ti = sides[i].texinfo;
+            s->surfaceflags = (ti >= 0 && ti < numtexinfo) ? LittleLong(texinfo[ti].flags) : 0;
+            if (s->planenum >= numplanes) {
+                fprintf(stderr, "Bad brush side plane in %s\n", entry.name);
+                r = false;
+            }
+        }
+
+    }
+
+    if (r) {
+        map->headnode = LittleLong(models[0].headnode);
+        memcpy(map->mins, models[0].mins, sizeof(map->mins));
+        memcpy(map->maxs, models[0].maxs, sizeof(map->maxs));
+        int h = map->headnode;
+        if (h >= numnodes || (h < 0 && -1 - h >= numleafs)) {
+            fprintf(stderr, "Bad head node in %s\n", entry.name);
+            r = false;
+        }
+    }
+
+    free(planes);
+    free(nodes);
+    free(leafs);
+    free(leafbrushes);
+    free(brushes);
+    free(sides);
+    free(texinfo);
+    free(models);
+    return r;
+}
+
+/* ================================================================== */
+
+int pointLeafnum(const collisionMap_t *map, const float p[3])
+{
+    if (map->nodes.empty()) {
+        return 0;
+    }
+
+    const cnode_t *nodes = map->nodes.data();
+    int num = map->headnode;
+    while (num >= 0) {
+        const cnode_t *node = &nodes[num];
+        float d;
+        if (node->type < 3) {
+            d = p[node->type] - node->dist;
+        } else {
+            d = DotProduct(node->normal, p) - node->dist;
+        }
+        num = node->children[d < 0];
+    }
+    return -1 - num;
+}
+
+int pointContents(const collisionMap_t *map, const float p[3])
+{
+    return map->leafs[pointLeafnum(map, p)].contents;
+}
+
+/* ================================================================== */
+
+static void clipBoxToBrush(const cbrush_t *brush)
+{
+    const collisionMap_t *map = work.map;
+    float enterfrac = -1;
+    float leavefrac = 1;
+    const cplane_t *clipplane = NULL;
+    const cbrushside_t *leadside = NULL;
+    bool getout = false;
+    bool startout = false;
+
+    if (!brush->numsides) {
+        return;
+    }
+
+    for (int i = 0; i < brush->numsides; i++) {
+        const cbrushside_t *side = &map->brushsides[brush->firstbrushside + i];
+        const cplane_t *plane = &map->planes[side->planenum];
+        float dist;
+
+        if (!work.ispoint) {
+            /* general box case, push the plane out
+               apropriately for mins/maxs */
+            float ofs[3];
+            for (int j = 0; j < 3; j++) {
+                ofs[j] = plane->normal[j] < 0 ? work.maxs[j] : work.mins[j];
+            }
+            dist = plane->dist - DotProduct(ofs, plane->normal);
+        } else {
+            /* special point case */
+            dist = plane->dist;
+        }
+
+        float d1 = DotProduct(work.start, plane->normal) - dist;
+        float d2 = DotProduct(work.end, plane->normal) - dist;
+
+        if (d2 > 0) {
+            getout = true; /* endpoint is not in solid */
+        }
+        if (d1 > 0) {
+            startout = true;
+        }
+
+        /* if completely in front of face, no intersection */
+        if ((d1 > 0) && (d2 >= d1)) {
+            return;
+        }
+        if ((d1 <= 0) && (d2 <= 0)) {
+            continue;
+        }
+
+        /* crosses face */
+        if (d1 > d2) {
+            /* enter */
+            float f = (d1 - DIST_EPSILON) / (d1 - d2);
+            if (f > enterfrac) {
+                enterfrac = f;
+                clipplane = plane;
+                leadside = side;
+            }
+        } else {
+            /* leave */
+            float f = (d1 + DIST_EPSILON) / (d1 - d2);
+            if (f < leavefrac) {
+                leavefrac = f;
+            }
+        }
+    }
+
+    if (!startout) {
+        /* original point was inside brush */
+        work.trace.startsolid = true;
+        if (!getout) {
+            work.trace.allsolid = true;
+        }
+        return;
+    }
+
+    if (enterfrac < leavefrac && enterfrac > -1 && enterfrac < work.trace.fraction) {
+        if (enterfrac < 0) {
+            enterfrac = 0;
+        }
+        work.trace.fraction = enterfrac;
+        work.trace.plane = *clipplane;
+        work.trace.surfaceflags = leadside->surfaceflags;
+        work.trace.contents = brush->contents;
+    }
+}
+
+static void testBoxInBrush(const cbrush_t *brush)
+{
+    const collisionMap_t *map = work.map;
+
+    if (!brush->numsides) {
+        return;
+    }
+
+    for (int i = 0; i < brush->numsides; i++) {
+        const cplane_t *plane = &map->planes[map->brushsides[brush->firstbrushside + i].planenum];
+
+        /* general box case, push the plane out
+           apropriately for mins/maxs */
+        float ofs[3];
+        for (int j = 0; j < 3; j++) {
+            ofs[j] = plane->normal[j] < 0 ? work.maxs[j] : work.mins[j];
+        }
+        float dist = plane->dist - DotProduct(ofs, plane->normal);
+        float d1 = DotProduct(work.start, plane->normal) - dist;
+
+        /* if completely in front of face, no intersection */
+        if (d1 > 0) {
+            return;
+        }
+    }
+
+    /* inside this brush */
+    work.trace.startsolid = work.trace.allsolid = true;
+    work.trace.fraction = 0;
+    work.trace.contents = brush->contents;
+}
+
+static void traceToLeaf(int leafnum, bool test)
+{
+    const collisionMap_t *map = work.map;
+    const cleaf_t *leaf = &map->leafs[leafnum];
+
+    if (!(leaf->contents & work.contents)) {
+        return;
+    }
+
+    /* trace line against all brushes in the leaf */
+    for (int k = 0; k < leaf->numleafbrushes; k++) {
+        int brushnum = map->leafbrushes[leaf->firstleafbrush + k];
+        if (work.checked[brushnum] == work.checkcount) {
+            continue; /* already checked this brush in another leaf */
+        }
+        work.checked[brushnum] = work.checkcount;
+
+        const cbrush_t *b = &map->brushes[brushnum];
+        if (!(b->contents & work.contents)) {
+            continue;
+        }
+
+        if (test) {
+            testBoxInBrush(b);
+            if (work.trace.allsolid) {
+                return;
+            }
+        } else {
+            clipBoxToBrush(b);
+            if (!work.trace.fraction) {
+                return;
+            }
+        }
+    }
+}
+
+/*
+ * Test the position box against the leafs it touches.
+ */
+static void testInLeafs(int num, const float mins[3], const float maxs[3])
+{
+    while (num >= 0) {
+        const cnode_t *node = &work.map->nodes[num];
+        float dmin, dmax;
+        if (node->type < 3) {
+            dmin = mins[node->type] - node->dist;
+            dmax = maxs[node->type] - node->dist;
+        } else {
+            float corners[2][3];
+            for (int i = 0; i < 3; i++) {
+                corners[0][i] = node->normal[i] < 0 ? maxs[i] : mins[i];
+                corners[1][i] = node->normal[i] < 0 ? mins[i] : maxs[i];
+            }
+            dmin = DotProduct(node->normal, corners[0]) - node->dist;
+            dmax = DotProduct(node->normal, corners[1]) - node->dist;
+        }
+
+        if (dmin >= 0) {
+            num = node->children[0];
+        } else if (dmax < 0) {
+            num = node->children[1];
+        } else {
+            /* go down both */
+            testInLeafs(node->children[0], mins, maxs);
+            if (work.trace.allsolid) {
+                return;
+            }
+            num = node->children[1];
+        }
+    }
+    traceToLeaf(-1 - num, true);
+}
+
+static void recursiveHullCheck(int num, float p1f, float p2f, const float p1[3], const float p2[3])
+{
+    /* if we already hit something nearer */
+    if (work.trace.fraction <= p1f) {
+        return;
+    }
+
+    /* if < 0, we are in a leaf node */
+    if (num < 0) {
+        traceToLeaf(-1 - num, false);
+        return;
+    }
+
+    /* find the point distances to the seperating plane
+       and the offset for the size of the box */
+    const cnode_t *node = &work.map->nodes[num];
+    float t1, t2, offset;
+
+    if (node->type < 3) {
+        t1 = p1[node->type] - node->dist;
+        t2 = p2[node->type] - node->dist;
+        offset = work.extents[node->type];
+    } else {
+        t1 = DotProduct(node->normal, p1) - node->dist;
+        t2 = DotProduct(node->normal, p2) - node->dist;
+        if (work.ispoint) {
+            offset = 0;
+        } else {
+            offset = fabsf(work.extents[0] * node->normal[0]) +
+                     fabsf(work.extents[1] * node->normal[1]) +
+                     fabsf(work.extents[2] * node->normal[2]);
+        }
+    }
+
+    /* see which sides we need to consider */
+    if ((t1 >= offset) && (t2 >= offset)) {
+        recursiveHullCheck(node->children[0], p1f, p2f, p1, p2);
+        return;
+    }
+    if ((t1 < -offset) && (t2 < -offset)) {
+        recursiveHullCheck(node->children[1], p1f, p2f, p1, p2);
+        return;
+    }
+
+    /* put the crosspoint DIST_EPSILON pixels on the near side */
+    int side;
+    float frac, frac2;
+    if (t1 < t2) {
+        float idist = 1.0f / (t1 - t2);
+        side = 1;
+        frac2 = (t1 + offset + DIST_EPSILON) * idist;
+        frac = (t1 - offset + DIST_EPSILON) * idist;
+    } else if (t1 > t2) {
+        float idist = 1.0f / (t1 - t2);
+        side = 0;
+        frac2 = (t1 - offset - DIST_EPSILON) * idist;
+        frac = (t1 + offset + DIST_EPSILON) * idist;
+    } else {
+        side = 0;
+        frac = 1;
+        frac2 = 0;
+    }
+
+    /* move up to the node */
+    if (frac < 0) {
+        frac = 0;
+    }
+    if (frac > 1) {
+        frac = 1;
+    }
+
+    float mid[3];
+    float midf = p1f + (p2f - p1f) * frac;
+    for (int i = 0; i < 3; i++) {
+        mid[i] = p1[i] + frac * (p2[i] - p1[i]);
+    }
+    recursiveHullCheck(node->children[side], p1f, midf, p1, mid);
+
+    /* go past the node */
+    if (frac2 < 0) {
+        frac2 = 0;
+    }
+    if (frac2 > 1) {
+        frac2 = 1;
+    }
+
+    midf = p1f + (p2f - p1f) * frac2;
+    for (int i = 0; i < 3; i++) {
+        mid[i] = p1[i] + frac2 * (p2[i] - p1[i]);
+    }
+    recursiveHullCheck(node->children[side ^ 1], midf, p2f, mid, p2);
+}
+
+trace_t boxTrace(const collisionMap_t *map, const float start[3], const float end[3],
+                 const float mins[3], const float maxs[3], int brushmask)
+{
+    if (work.map != map || work.checked.size() != map->brushes.size()) {
+        work.map = map;
+        work.checked.assign(map->brushes.size(), 0);
+        work.checkcount = 0;
+    }
+    if (++work.checkcount == 0) {
+        /* wrapped around, forget the old stamps */
+        std::fill(work.checked.begin(), work.checked.end(), 0);
+        work.checkcount = 1;
+    }
+
+    /* fill in a default trace */
+    memset(&work.trace, 0, sizeof(work.trace));
+    work.trace.fraction = 1;
+
+    if (map->nodes.empty()) { /* map not loaded */
+        memcpy(work.trace.endpos, end, sizeof(work.trace.endpos));
+        return work.trace;
+    }
+
+    work.contents = brushmask;
+    memcpy(work.start, start, sizeof(work.start));
+    memcpy(work.end, end, sizeof(work.end));
+    memcpy(work.mins, mins, sizeof(work.mins));
+    memcpy(work.maxs, maxs, sizeof(work.maxs));
+
+    /* check for position test special case */
+    if (start[0] == end[0] && start[1] == end[1] && start[2] == end[2]) {
+        float c1[3], c2[3];
+        for (int i = 0; i < 3; i++) {
+            c1[i] = start[i] + mins[i] - 1;
+            c2[i] = start[i] + maxs[i] + 1;
+        }
+        testInLeafs(map->headnode, c1, c2);
+        memcpy(work.trace.endpos, start, sizeof(work.trace.endpos));
+        return work.trace;
+    }
+
+    /* check for point special case */
+    if (mins[0] == 0 && mins[1] == 0 && mins[2] == 0 &&
+        maxs[0] == 0 && maxs[1] == 0 && maxs[2] == 0) {
+        work.ispoint = true;
+        work.extents[0] = work.extents[1] = work.extents[2] = 0;
+    } else {
+        work.ispoint = false;
+        for (int i = 0; i < 3; i++) {
+            work.extents[i] = -mins[i] > maxs[i] ? -mins[i] : maxs[i];
+        }
+    }
+
+    /* general sweeping through world */
+    recursiveHullCheck(map->headnode, 0, 1, start, end);
+
+    if (work.trace.fraction == 1) {
+        memcpy(work.trace.endpos, end, sizeof(work.trace.endpos));
+    } else {
+        for (int i = 0; i < 3; i++) {
+            work.trace.endpos[i] = start[i] + work.trace.fraction * (end[i] - start[i]);
+        }
+    }
+    return work.trace;
+}
+
+/* ================================================================== */
+
+static float randomFloat(uint32_t *seed, float lo, float hi)
+{
+    /* xorshift32 */
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return lo + (hi - lo) * float(x >> 8) * (1.0f / 16777216.0f);
+}
+
+bool benchmarkTraces(int count)
+{
+    static const float pointMins[3] = {0, 0, 0};
+    static const float pointMaxs[3] = {0, 0, 0};
+    static const float playerMins[3] = {-16, -16, -24};
+    static const float playerMaxs[3] = {16, 16, 32};
+    const int chunk = 4096;
+
+    std::vector<const fileEntry *> maps;
+    findMaps(maps);
+
+    for (const fileEntry *entry : maps) {
+        collisionMap_t map;
+        if (!loadCollisionMap(*entry, &map)) {
+            return false;
+        }
+
+        std::atomic<int> hits(0);
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        parallelFor((count + chunk - 1) / chunk, [&](int c) {
+            uint32_t seed = 0x9e3779b9u * uint32_t(c + 1);
+            int n = count - c * chunk < chunk ? count - c * chunk : chunk;
+            int h = 0;
+            for (int i = 0; i < n; i++) {
+                float start[3], end[3];
+                for (int j = 0; j < 3; j++) {
+                    start[j] = randomFloat(&seed, map.mins[j], map.maxs[j]);
+                    end[j] = randomFloat(&seed, map.mins[j], map.maxs[j]);
+                }
+                bool box = i & 1;
+                trace_t tr = boxTrace(&map, start, end, box ? playerMins : pointMins,
+                                      box ? playerMaxs : pointMaxs, CONTENTS_SOLID | CONTENTS_PLAYERCLIP);
+                if (tr.fraction < 1 || tr.startsolid) {
+                    h++;
+                }
+            }
+            hits += h;
+            return true;
+        });
+        std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+
+        printf("%s: %d traces in %.3f s, %.0f traces/s, %d hits\n", entry->name, count,
+               dt.count(), count / dt.count(), int(hits));
+    }
+    return true;
+}
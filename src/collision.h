@@ -0,0 +1,124 @@
+/*
+* Copyright (C) 1997-2001 Id Software, Inc.
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Collision queries against the BSP tree of a map, after cmodel.c
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_COLLISION_H
+#define Q2UNPACK_COLLISION_H
+
+#include "common.h"
+
+typedef struct
+{
+    float normal[3];
+    float dist;
+    int type;
+} cplane_t;
+
+/* Nodes carry their plane so the tree walk touches one array only.
+ * type is PLANE_X..PLANE_Z only for planes facing the positive axis,
+ * those are tested with a single compare. */
+typedef struct
+{
+    float normal[3];
+    float dist;
+    int type;
+    int children[2]; /* negative numbers are -(leafs+1), not nodes */
+    int pad;
+} cnode_t;
+
+typedef struct
+{
+    int contents;
+    int cluster;
+    int area;
+    int firstleafbrush;
+    int numleafbrushes;
+} cleaf_t;
+
+typedef struct
+{
+    int planenum;
+    int surfaceflags;
+} cbrushside_t;
+
+typedef struct
+{
+    int contents;
+    int numsides;
+    int firstbrushside;
+} cbrush_t;
+
+typedef struct
+{
+    std::vector<cnode_t> nodes;
+    std::vector<cplane_t> planes;
+    std::vector<cleaf_t> leafs;
+    std::vector<int> leafbrushes;
+    std::vector<cbrush_t> brushes;
+    std::vector<cbrushside_t> brushsides;
+    int headnode;
+    float mins[3], maxs[3]; /* world model bounds */
+} collisionMap_t;
+
+typedef struct
+{
+    bool allsolid;    /* if true, plane is not valid */
+    bool startsolid;  /* if true, the initial point was in a solid area */
+    float fraction;   /* time completed, 1.0 = didn't hit anything */
+    float endpos[3];  /* final position */
+    cplane_t plane;   /* surface normal at impact */
+    int surfaceflags; /* SURF_* of the surface hit */
+    int contents;     /* contents on other side of surface hit */
+} trace_t;
+
+/*
+ * Load the collision data of a BSP entry.
+ */
+bool loadCollisionMap(const fileEntry& entry, collisionMap_t *map);
+
+/*
+ * Find the leaf containing a point.
+ */
+int pointLeafnum(const collisionMap_t *map, const float p[3]);
+
+/*
+ * Get the contents of the leaf containing a point.
+ */
+int pointContents(const collisionMap_t *map, const float p[3]);
+
+/*
+ * Sweep a box from start to end through the world and return the first
+ * brush of brushmask contents it hits. Traces may be run concurrently.
+ */
+trace_t boxTrace(const collisionMap_t *map, const float start[3], const float end[3],
+                 const float mins[3], const float maxs[3], int brushmask);
+
+/*
+ * Run count random traces in every map and report the throughput.
+ */
+bool benchmarkTraces(int count);
+
+#endif
@@ -0,0 +1,346 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include "common.h"
+
+bool hasExtension(const char *name, const char *ext)
+{
+    size_t len = strlen(name);
+    size_t extlen = strlen(ext);
+    return len > extlen && strcmp(&name[len - extlen], ext) == 0;
+}
+
+std::string lowerName(const char *name)
+{
+    return lowerName(name, strlen(name));
+}
+
+std::string lowerName(const char *name, size_t len)
+{
+    std::string s(name, len);
+    for (size_t i = 0; i < s.size(); i++) {
+        s[i] = tolower(s[i]);
+    }
+    return s;
+}
+
+void writeJsonString(FILE *f, const char *s, int len)
+{
+    fputc('"', f);
+    for (int i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            fputc('\\', f);
+            fputc(c, f);
+        } else if (c == '\n') {
+            fputs("\\n", f);
+        } else if (c < ' ') {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+bool readEntry(const fileEntry& entry, long offset, void *buffer, long length)
+{
+    if (offset < 0 || length < 0 || offset + length > entry.length) {
+        fprintf(stderr, "Read outside of %s\n", entry.name);
+        return false;
+    }
+
+    int fd = fileno(entry.file);
+    char *dst = (char *)buffer;
+    off_t pos = entry.offset + offset;
+    while (length > 0) {
+        ssize_t l = pread(fd, dst, size_t(length), pos);
+        if (l <= 0) {
+            fprintf(stderr, "Failed to read %s\n", entry.name);
+            return false;
+        }
+        dst += l;
+        pos += l;
+        length -= l;
+    }
+    return true;
+}
+
+bool streamEntry(const fileEntry& entry, int fd)
+{
+    off_t offset = entry.offset;
+    off_t end = entry.offset + entry.length;
+#ifdef __linux__
+    while (offset < end) {
+        ssize_t n = sendfile(fd, fileno(entry.file), &offset, size_t(end - offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break; /* not supported for this output, copy the rest */
+        }
+    }
+#endif
+    std::vector<byte> buffer(0x10000);
+    while (offset < end) {
+        size_t len = end - offset < off_t(buffer.size()) ? size_t(end - offset) : buffer.size();
+        ssize_t n = pread(fileno(entry.file), buffer.data(), len, offset);
+        if (n <= 0) {
+            fprintf(stderr, "Failed to read %s\n", entry.name);
+            return false;
+        }
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t w = write(fd, buffer.data() + done, size_t(n - done));
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w <= 0) {
+                fprintf(stderr, "Failed to write %s\n", entry.name);
+                return false;
+            }
+            done += w;
+        }
+        offset += n;
+    }
+    return true;
+}
+
+byte *loadEntry(const fileEntry& entry)
+{
+    /* One extra byte so text lumps can always be terminated. */
+    byte *data = (byte *)malloc(entry.length + 1);
+    if (data == NULL) {
+        fprintf(stderr, "Out of memory loading %s\n", entry.name);
+        return NULL;
+    }
+    if (!readEntry(entry, 0, data, entry.length)) {
+        free(data);
+        return NULL;
+    }
+    data[entry.length] = 0;
+    return data;
+}
+
+uint32_t *loadWal(const fileEntry& entry, int *width, int *height)
+{
+    miptex_t mt;
+    if (!readEntry(entry, 0, &mt, sizeof(mt))) {
+        return NULL;
+    }
+
+    if ((mt.offsets[0] <= 0) || (mt.width <= 0) || (mt.height <= 0) ||
+        (mt.width > 4096) || (mt.height > 4096) ||
+        (((entry.length - mt.offsets[0]) / mt.height) < mt.width)) {
+        fprintf(stderr, "Bad mip file %s\n", entry.name);
+        return NULL;
+    }
+
+    int fullsize = mt.width * mt.height;
+    byte *raw = (byte *)malloc(fullsize);
+    if (!readEntry(entry, mt.offsets[0], raw, fullsize)) {
+        free(raw);
+        return NULL;
+    }
+
+    uint32_t *out = (uint32_t *)malloc(fullsize * 4);
+    for (int i = 0; i < fullsize; i++) {
+        out[i] = d_8to24table[raw[i]];
+    }
+    free(raw);
+
+    *width = mt.width;
+    *height = mt.height;
+    return out;
+}
+
+bool createOutputPath(const char *outPath, const char *name, const char *ext,
+                      char *fullpath, size_t size)
+{
+    size_t outlen = strlen(outPath);
+    bool slash = outlen > 0 && outPath[outlen - 1] == '/';
+    int l = snprintf(fullpath, size, "%s%s%s", outPath, slash ? "" : "/", name);
+    if (l < 0 || size_t(l) >= size) {
+        fprintf(stderr, "Path too long for %s\n", name);
+        return false;
+    }
+
+    if (ext != NULL) {
+        char *dot = strrchr(fullpath, '.');
+        char *sep = strrchr(fullpath, '/');
+        if (dot == NULL || (sep != NULL && dot < sep)) {
+            dot = fullpath + l;
+        }
+        if (size_t(dot - fullpath) + strlen(ext) >= size) {
+            fprintf(stderr, "Path too long for %s\n", name);
+            return false;
+        }
+        strcpy(dot, ext);
+    }
+
+    /* Only the part coming from the entry is lowercased and created. */
+    for (char *s = fullpath + outlen; *s; s++) {
+        *s = tolower(*s);
+    }
+    for (char *s = fullpath + outlen + (slash ? 0 : 1); *s; s++) {
+        if (*s == '/') {
+            *s = 0;
+            mkdir(fullpath, 0777);
+            *s = '/';
+        }
+    }
+    return true;
+}
+
+FILE *createOutputFile(const char *path)
+{
+    unlink(path);
+    return fopen(path, "wb");
+}
+
+std::string tempPath(const std::string& path)
+{
+    static std::atomic<int> temps(0);
+    char host[256];
+    if (gethostname(host, sizeof(host)) != 0) {
+        strcpy(host, "localhost");
+    }
+    host[sizeof(host) - 1] = 0;
+    for (char *c = host; *c; c++) {
+        if (*c == '/') {
+            *c = '_';
+        }
+    }
+    char suffix[300];
+    snprintf(suffix, sizeof(suffix), ".%s.%d.%d", host, int(getpid()), temps++);
+    return path + suffix;
+}
+
+bool parallelFor(int count, const std::function<bool(int)>& func)
+{
+    std::atomic<int> next(0);
+    std::atomic<bool> ok(true);
+
+    int numThreads = int(std::thread::hardware_concurrency());
+    if (numThreads < 1) {
+        numThreads = 1;
+    }
+    if (numThreads > count) {
+        numThreads = count;
+    }
+
+    auto worker = [&]() {
+        for (int i = next++; i < count; i = next++) {
+            if (!func(i)) {
+                ok = false;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < numThreads; i++) {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    return ok;
+}
+
+bool orderedParallelFor(int count, int window, const std::function<bool(int)>& produce,
+                        const std::function<bool(int)>& consume)
+{
+    if (window < 1) {
+        window = 1;
+    }
+    std::mutex lock;
+    std::condition_variable changed;
+    std::vector<bool> ready(window, false);
+    int next = 0;
+    int consumed = 0;
+    bool ok = true;
+
+    /* the calling thread only consumes, so there is always a producer */
+    int numThreads = int(std::thread::hardware_concurrency());
+    if (numThreads < 1) {
+        numThreads = 1;
+    }
+    if (numThreads > count) {
+        numThreads = count;
+    }
+
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> l(lock);
+        for (;;) {
+            changed.wait(l, [&]() { return !ok || next >= count || next < consumed + window; });
+            if (!ok || next >= count) {
+                return;
+            }
+            int i = next++;
+            l.unlock();
+            bool r = produce(i);
+            l.lock();
+            ok = ok && r;
+            ready[i % window] = true;
+            changed.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++) {
+        threads.push_back(std::thread(worker));
+    }
+
+    std::unique_lock<std::mutex> l(lock);
+    for (int i = 0; i < count && ok; i++) {
+        changed.wait(l, [&]() { return !ok || ready[i % window]; });
+        if (!ok) {
+            break;
+        }
+        ready[i % window] = false;
+        l.unlock();
+        bool r = consume(i);
+        l.lock();
+        ok = ok && r;
+        consumed = i + 1;
+        changed.notify_all();
+    }
+    ok = ok && consumed == count;
+    changed.notify_all();
+    l.unlock();
+
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    return ok;
+}
@@ -0,0 +1,147 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Entry table and helpers shared by the unpacker and the exporters
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_COMMON_H
+#define Q2UNPACK_COMMON_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <functional>
+#include "files.h"
+
+#define LittleLong(x) x
+
+typedef struct
+{
+    char name[256];
+    FILE *file;
+    int offset;
+    long length;
+    const char *source; /* Path of the pak or loose file the data is in. */
+} fileEntry;
+
+/* All files found from the input, in load order. */
+extern std::vector<fileEntry> entries;
+
+/* Palette from pics/colormap.pcx, 255 is transparent. */
+extern uint32_t d_8to24table[256];
+
+/*
+ * Find an entry for specific file by name, case insensitively. Same as
+ * lookupEntry, the first entry of a name wins.
+ */
+fileEntry* findEntry(const char *path);
+
+/*
+ * Create a PNG from RGBA pixel data.
+ */
+bool writePng(const char *name, int width, int height, const uint32_t *data);
+
+/*
+ * Encode RGBA pixel data as PNG, appending it to out.
+ */
+bool encodePng(int width, int height, const uint32_t *data, std::vector<byte>& out);
+
+/*
+ * Check whether name ends with the given extension (".bsp" etc).
+ */
+bool hasExtension(const char *name, const char *ext);
+
+/*
+ * Lowercase copy of a name, the form names are compared and written in.
+ */
+std::string lowerName(const char *name);
+std::string lowerName(const char *name, size_t len);
+
+/*
+ * Write a quoted, escaped JSON string of len characters.
+ */
+void writeJsonString(FILE *f, const char *s, int len);
+
+/*
+ * Read a range of an entry. Uses positioned reads so it is safe to
+ * call from several threads on entries sharing the same pak handle.
+ */
+bool readEntry(const fileEntry& entry, long offset, void *buffer, long length);
+
+/*
+ * Copy an entry to a file descriptor, letting the kernel move the data
+ * where it can.
+ */
+bool streamEntry(const fileEntry& entry, int fd);
+
+/*
+ * Read the whole entry to a malloc'd buffer. Returns NULL on failure.
+ */
+byte *loadEntry(const fileEntry& entry);
+
+/*
+ * Decode the first mip level of a WAL entry to RGBA with d_8to24table.
+ * Returns a malloc'd buffer or NULL on failure.
+ */
+uint32_t *loadWal(const fileEntry& entry, int *width, int *height);
+
+/*
+ * Build the output path for an entry name under outPath, creating the
+ * directories on the way. If ext is given it replaces the extension
+ * of the name. The resulting path is lowercased.
+ */
+bool createOutputPath(const char *outPath, const char *name, const char *ext,
+                      char *fullpath, size_t size);
+
+/*
+ * Create an output file for writing. An existing file is unlinked rather
+ * than truncated, as it may be a hard link into a store.
+ */
+FILE *createOutputFile(const char *path);
+
+/*
+ * Name a file next to path to write before renaming or linking it into
+ * place. The name holds the host, process and a counter, so writers on
+ * several machines sharing the directory do not collide. It always has
+ * a '.' after the name of path.
+ */
+std::string tempPath(const std::string& path);
+
+/*
+ * Run func for every index in [0, count) on all available cores.
+ * Returns false if any of the calls returned false.
+ */
+bool parallelFor(int count, const std::function<bool(int)>& func);
+
+/*
+ * Run produce for every index in [0, count) on all available cores and
+ * consume on the calling thread strictly in index order. At most window
+ * results are in flight, so the caller can keep them in window slots
+ * indexed by i % window. Stops at the first call returning false.
+ */
+bool orderedParallelFor(int count, int window, const std::function<bool(int)>& produce,
+                        const std::function<bool(int)>& consume);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "pak.h"
+#include "delta.h"
+
+#define DELTA_CHUNK_SIZE 0x10000
+
+typedef enum
+{
+    DELTA_ADDED,
+    DELTA_CHANGED,
+    DELTA_SAME
+} deltaState_t;
+
+/*
+ * Index the resolved entries of a table by lowercased name, first one
+ * wins, so names compare like in lookupEntry.
+ */
+static void indexEntries(const std::vector<fileEntry>& table, std::unordered_map<std::string, int>& index)
+{
+    for (size_t i = 0; i < table.size(); i++) {
+        index.insert(std::make_pair(lowerName(table[i].name), int(i)));
+    }
+}
+
+/*
+ * Both entries are the same range of the same file, e.g. a pak both
+ * versions share.
+ */
+static bool sameRange(const fileEntry& a, const fileEntry& b)
+{
+    struct stat sa, sb;
+    return a.offset == b.offset && a.length == b.length &&
+        fstat(fileno(a.file), &sa) == 0 && fstat(fileno(b.file), &sb) == 0 &&
+        sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+static bool entryCrc(const fileEntry& entry, unsigned long *crc)
+{
+    std::vector<byte> buffer(DELTA_CHUNK_SIZE);
+    uLong c = crc32(0, Z_NULL, 0);
+    for (long ofs = 0; ofs < entry.length; ofs += DELTA_CHUNK_SIZE) {
+        long len = entry.length - ofs < DELTA_CHUNK_SIZE ? entry.length - ofs : DELTA_CHUNK_SIZE;
+        if (!readEntry(entry, ofs, buffer.data(), len)) {
+            return false;
+        }
+        c = crc32(c, buffer.data(), uInt(len));
+    }
+    *crc = c;
+    return true;
+}
+
+bool writeDelta(const std::vector<fileEntry>& oldEntries, const char *pakPath)
+{
+    std::unordered_map<std::string, int> oldIndex, newIndex;
+    indexEntries(oldEntries, oldIndex);
+    indexEntries(entries, newIndex);
+
+    /* sizes and shared ranges settle most files, only the rest are read */
+    std::vector<deltaState_t> states(entries.size(), DELTA_SAME);
+    std::vector<int> others(entries.size(), -1);
+    std::vector<int> hashed;
+    for (std::unordered_map<std::string, int>::const_iterator it = newIndex.begin(); it != newIndex.end(); ++it) {
+        int i = it->second;
+        std::unordered_map<std::string, int>::const_iterator old = oldIndex.find(it->first);
+        if (old == oldIndex.end()) {
+            states[i] = DELTA_ADDED;
+        } else if (oldEntries[old->second].length != entries[i].length) {
+            states[i] = DELTA_CHANGED;
+        } else if (!sameRange(oldEntries[old->second], entries[i])) {
+            others[i] = old->second;
+            hashed.push_back(i);
+        }
+    }
+
+    bool r = parallelFor(int(hashed.size()), [&](int j) {
+        int i = hashed[j];
+        unsigned long a, b;
+        if (!entryCrc(entries[i], &a) || !entryCrc(oldEntries[others[i]], &b)) {
+            return false;
+        }
+        if (a != b) {
+            states[i] = DELTA_CHANGED;
+        }
+        return true;
+    });
+    if (!r) {
+        return false;
+    }
+
+    std::vector<bool> selected(entries.size(), false);
+    int added = 0, changed = 0;
+    for (std::unordered_map<std::string, int>::const_iterator it = newIndex.begin(); it != newIndex.end(); ++it) {
+        deltaState_t state = states[it->second];
+        selected[it->second] = state != DELTA_SAME;
+        added += state == DELTA_ADDED;
+        changed += state == DELTA_CHANGED;
+    }
+
+    std::vector<std::string> deleted;
+    for (std::unordered_map<std::string, int>::const_iterator it = oldIndex.begin(); it != oldIndex.end(); ++it) {
+        if (newIndex.find(it->first) == newIndex.end()) {
+            deleted.push_back(oldEntries[it->second].name);
+        }
+    }
+    std::sort(deleted.begin(), deleted.end());
+
+    printf("Delta: %d added, %d changed, %lu deleted, %lu compared\n", added, changed, deleted.size(),
+           hashed.size());
+
+    if (added + changed > 0) {
+        std::vector<int> order;
+        if (!pakOrder(selected, order) || !writePak(pakPath, order)) {
+            return false;
+        }
+    } else if (unlink(pakPath) != 0 && errno != ENOENT) {
+        /* a pak left from an earlier run would not match the manifest */
+        fprintf(stderr, "Failed to remove %s\n", pakPath);
+        return false;
+    }
+
+    std::string manifest(pakPath);
+    size_t dot = manifest.rfind('.');
+    if (dot != std::string::npos && manifest.find('/', dot) == std::string::npos) {
+        manifest.resize(dot);
+    }
+    manifest += ".deleted";
+
+    FILE *f = fopen(manifest.c_str(), "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", manifest.c_str());
+        return false;
+    }
+    for (const std::string& name : deleted) {
+        fprintf(f, "%s\n", name.c_str());
+    }
+    r = !ferror(f);
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", manifest.c_str());
+        return false;
+    }
+    return true;
+}
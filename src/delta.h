@@ -0,0 +1,41 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Delta paks between two versions of a game
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_DELTA_H
+#define Q2UNPACK_DELTA_H
+
+#include "common.h"
+
+/*
+ * Compare the resolved files of an older input with the current
+ * entries. Names are compared case insensitively. Added and changed
+ * files are written to a pak, or an old pak is removed when there are
+ * none, and the names of the removed ones, one per line, to the pak
+ * path with the extension replaced by ".deleted".
+ */
+bool writeDelta(const std::vector<fileEntry>& oldEntries, const char *pakPath);
+
+#endif
@@ -0,0 +1,337 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <unordered_map>
+#include "bsp.h"
+#include "entities.h"
+#include "depends.h"
+
+static std::unordered_map<std::string, int> entryIndex;
+static size_t indexedEntries;
+
+/*
+ * Build the name index. Must be done before lookups from worker threads.
+ */
+static void buildEntryIndex()
+{
+    if (indexedEntries == entries.size()) {
+        return;
+    }
+    entryIndex.clear();
+    for (size_t i = 0; i < entries.size(); i++) {
+        /* First one wins, it comes first in the search order */
+        entryIndex.insert(std::make_pair(lowerName(entries[i].name), int(i)));
+    }
+    indexedEntries = entries.size();
+}
+
+void resetEntryIndex()
+{
+    indexedEntries = size_t(-1);
+}
+
+int lookupEntry(const char *name)
+{
+    buildEntryIndex();
+    std::unordered_map<std::string, int>::const_iterator it = entryIndex.find(lowerName(name));
+    return it == entryIndex.end() ? -1 : it->second;
+}
+
+static void addTexture(const char *name, size_t len, std::vector<std::string>& deps)
+{
+    if (len == 0) {
+        return;
+    }
+    deps.push_back("textures/" + std::string(name, len) + ".wal");
+}
+
+static bool bspDependencies(const fileEntry& entry, std::vector<std::string>& deps)
+{
+    bspFile_t bsp;
+    if (!openBsp(entry, &bsp)) {
+        return false;
+    }
+
+    int numtexinfo;
+    texinfo_t *texinfo = (texinfo_t *)loadBspLump(&bsp, LUMP_TEXINFO, sizeof(texinfo_t), &numtexinfo);
+    if (texinfo == NULL) {
+        return false;
+    }
+    for (int i = 0; i < numtexinfo; i++) {
+        addTexture(texinfo[i].texture, strnlen(texinfo[i].texture, sizeof(texinfo[i].texture)), deps);
+    }
+    free(texinfo);
+
+    entityList_t list;
+    char *text = loadEntities(entry, &list);
+    if (text == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < list.entities.size(); i++) {
+        const entityPair_t *model = findEntityKey(&list, int(i), "model");
+        if (model && model->valuelen > 0 && model->value[0] != '*') {
+            deps.push_back(std::string(model->value, model->valuelen));
+        }
+
+        const entityPair_t *noise = findEntityKey(&list, int(i), "noise");
+        if (noise && noise->valuelen > 0) {
+            std::string s = "sound/" + std::string(noise->value, noise->valuelen);
+            if (!hasExtension(s.c_str(), ".wav")) {
+                s += ".wav";
+            }
+            deps.push_back(s);
+        }
+    }
+
+    /* the worldspawn comes first, without a sky the game uses unit1_ */
+    const entityPair_t *sky = list.entities.empty() ? NULL : findEntityKey(&list, 0, "sky");
+    std::string skyName = sky && sky->valuelen > 0 ? std::string(sky->value, sky->valuelen) : "unit1_";
+    static const char *suf[6] = {"rt", "bk", "lf", "ft", "up", "dn"};
+    for (int j = 0; j < 6; j++) {
+        std::string s = "env/" + skyName + suf[j];
+        /* Either one may be there, the missing one is not reported */
+        if (lookupEntry((s + ".pcx").c_str()) >= 0) {
+            deps.push_back(s + ".pcx");
+        }
+        if (lookupEntry((s + ".tga").c_str()) >= 0) {
+            deps.push_back(s + ".tga");
+        }
+    }
+    free(text);
+    return true;
+}
+
+static bool walDependencies(const fileEntry& entry, std::vector<std::string>& deps)
+{
+    miptex_t mt;
+    if (!readEntry(entry, 0, &mt, sizeof(mt))) {
+        return false;
+    }
+    addTexture(mt.animname, strnlen(mt.animname, sizeof(mt.animname)), deps);
+    return true;
+}
+
+static bool md2Dependencies(const fileEntry& entry, std::vector<std::string>& deps)
+{
+    dmdl_t header;
+    if (!readEntry(entry, 0, &header, sizeof(header))) {
+        return false;
+    }
+    int num_skins = LittleLong(header.num_skins);
+    int ofs_skins = LittleLong(header.ofs_skins);
+    if (LittleLong(header.ident) != IDALIASHEADER || num_skins < 0 || num_skins > MAX_MD2SKINS) {
+        fprintf(stderr, "Bad md2 file %s\n", entry.name);
+        return false;
+    }
+
+    char skins[MAX_MD2SKINS][MAX_SKINNAME];
+    if (!readEntry(entry, ofs_skins, skins, num_skins * MAX_SKINNAME)) {
+        return false;
+    }
+    for (int i = 0; i < num_skins; i++) {
+        size_t len = strnlen(skins[i], MAX_SKINNAME);
+        if (len > 0) {
+            deps.push_back(std::string(skins[i], len));
+        }
+    }
+    return true;
+}
+
+static bool sp2Dependencies(const fileEntry& entry, std::vector<std::string>& deps)
+{
+    int header[3];
+    if (!readEntry(entry, 0, header, sizeof(header))) {
+        return false;
+    }
+    int numframes = LittleLong(header[2]);
+    if (LittleLong(header[0]) != IDSPRITEHEADER || numframes < 0 || numframes > MAX_FRAMES) {
+        fprintf(stderr, "Bad sp2 file %s\n", entry.name);
+        return false;
+    }
+
+    std::vector<dsprframe_t> frames(numframes);
+    if (!readEntry(entry, sizeof(header), frames.data(), numframes * sizeof(dsprframe_t))) {
+        return false;
+    }
+    for (int i = 0; i < numframes; i++) {
+        size_t len = strnlen(frames[i].name, MAX_SKINNAME);
+        if (len > 0) {
+            deps.push_back(std::string(frames[i].name, len));
+        }
+    }
+    return true;
+}
+
+bool entryDependencies(const fileEntry& entry, std::vector<std::string>& deps)
+{
+    if (hasExtension(entry.name, ".bsp")) {
+        return bspDependencies(entry, deps);
+    } else if (hasExtension(entry.name, ".wal")) {
+        return walDependencies(entry, deps);
+    } else if (hasExtension(entry.name, ".md2")) {
+        return md2Dependencies(entry, deps);
+    } else if (hasExtension(entry.name, ".sp2")) {
+        return sp2Dependencies(entry, deps);
+    }
+    return true;
+}
+
+bool dependencyClosure(const std::vector<int>& roots, std::vector<bool>& needed)
+{
+    buildEntryIndex();
+    needed.assign(entries.size(), false);
+
+    std::vector<int> frontier;
+    for (int root : roots) {
+        if (!needed[root]) {
+            needed[root] = true;
+            frontier.push_back(root);
+        }
+    }
+
+    while (!frontier.empty()) {
+        std::vector<std::vector<std::string> > deps(frontier.size());
+        bool r = parallelFor(int(frontier.size()), [&](int i) {
+            return entryDependencies(entries[frontier[i]], deps[i]);
+        });
+        if (!r) {
+            return false;
+        }
+
+        std::vector<int> next;
+        for (size_t i = 0; i < frontier.size(); i++) {
+            for (const std::string& name : deps[i]) {
+                int index = lookupEntry(name.c_str());
+                if (index < 0) {
+                    fprintf(stderr, "Missing %s needed by %s\n", name.c_str(), entries[frontier[i]].name);
+                } else if (!needed[index]) {
+                    needed[index] = true;
+                    next.push_back(index);
+                }
+            }
+        }
+        frontier.swap(next);
+    }
+    return true;
+}
+
+bool selectMaps(const char *list, std::vector<bool>& needed)
+{
+    std::vector<int> roots;
+    const char *s = list;
+    while (*s) {
+        const char *e = strchr(s, ',');
+        size_t len = e ? size_t(e - s) : strlen(s);
+        if (len > 0) {
+            std::string name(s, len);
+            if (name.find('/') == std::string::npos) {
+                name = "maps/" + name;
+            }
+            if (!hasExtension(name.c_str(), ".bsp")) {
+                name += ".bsp";
+            }
+            int index = lookupEntry(name.c_str());
+            if (index < 0) {
+                fprintf(stderr, "Cannot find map %s\n", name.c_str());
+                return false;
+            }
+            roots.push_back(index);
+        }
+        s += len;
+        if (*s == ',') {
+            s++;
+        }
+    }
+
+    if (!dependencyClosure(roots, needed)) {
+        return false;
+    }
+
+    int count = 0;
+    for (size_t i = 0; i < needed.size(); i++) {
+        count += needed[i];
+    }
+    printf("Maps need %d files\n", count);
+    return true;
+}
+
+/*
+ * Only assets whose every user is visible in the data can be unused.
+ */
+static bool isPrunable(const char *name)
+{
+    if (hasExtension(name, ".wal")) {
+        return strncmp(name, "textures/", 9) == 0;
+    }
+    if (hasExtension(name, ".pcx") || hasExtension(name, ".tga")) {
+        return strncmp(name, "env/", 4) == 0 || strncmp(name, "models/", 7) == 0 ||
+            strncmp(name, "sprites/", 8) == 0;
+    }
+    return false;
+}
+
+bool findUnused(std::vector<bool>& unused)
+{
+    buildEntryIndex();
+
+    std::vector<int> roots;
+    for (size_t i = 0; i < entries.size(); i++) {
+        const char *name = entries[i].name;
+        if (lookupEntry(name) == int(i) &&
+            ((strncmp(name, "maps/", 5) == 0 && hasExtension(name, ".bsp")) ||
+             hasExtension(name, ".md2") || hasExtension(name, ".sp2"))) {
+            roots.push_back(int(i));
+        }
+    }
+
+    std::vector<bool> needed;
+    if (!dependencyClosure(roots, needed)) {
+        return false;
+    }
+
+    unused.assign(entries.size(), false);
+    for (size_t i = 0; i < entries.size(); i++) {
+        /* Shadowed copies go with the entry the name resolves to */
+        unused[i] = isPrunable(entries[i].name) && !needed[lookupEntry(entries[i].name)];
+    }
+    return true;
+}
+
+bool reportUnused()
+{
+    std::vector<bool> unused;
+    if (!findUnused(unused)) {
+        return false;
+    }
+
+    int count = 0;
+    long total = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (unused[i]) {
+            printf("Unused %s %ld\n", entries[i].name, entries[i].length);
+            count++;
+            total += entries[i].length;
+        }
+    }
+    printf("%d unused files, %ld bytes\n", count, total);
+    return true;
+}
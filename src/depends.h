@@ -0,0 +1,78 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Asset references between maps, textures, models and sprites
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_DEPENDS_H
+#define Q2UNPACK_DEPENDS_H
+
+#include <string>
+#include "common.h"
+
+/*
+ * Find the index of the entry a name resolves to, -1 if there is none.
+ * Lookups are case insensitive and the first entry of a name wins, which
+ * with paks loaded in front is the copy the game would use. findEntry
+ * goes through here too.
+ */
+int lookupEntry(const char *name);
+
+/*
+ * Rebuild the name index on the next lookup. Needed after entries
+ * change without the table changing size.
+ */
+void resetEntryIndex();
+
+/*
+ * List the names an entry refers to:
+ * BSP texinfo textures and entity models, sounds and sky images,
+ * WAL animation frames, MD2 skins and SP2 frames.
+ * Only the headers and lumps holding the references are read.
+ */
+bool entryDependencies(const fileEntry& entry, std::vector<std::string>& deps);
+
+/*
+ * Mark the roots and everything reachable from them in needed, which
+ * is indexed like entries. Each level of the graph is read in parallel.
+ */
+bool dependencyClosure(const std::vector<int>& roots, std::vector<bool>& needed);
+
+/*
+ * Mark the closure of a comma separated list of maps ("base1,base2").
+ */
+bool selectMaps(const char *list, std::vector<bool>& needed);
+
+/*
+ * Mark the assets no map or model refers to: textures, sky images and
+ * model and sprite skins. Everything else may be loaded by game code
+ * and is never marked.
+ */
+bool findUnused(std::vector<bool>& unused);
+
+/*
+ * Print the unused assets and their total size.
+ */
+bool reportUnused();
+
+#endif
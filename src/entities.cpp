@@ -0,0 +1,288 @@
+/*
+* Copyright (C) 1997-2001 Id Software, Inc.
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include "bsp.h"
+#include "entities.h"
+
+typedef struct
+{
+    const char *s;
+    int len;
+    bool quoted;
+} entityToken_t;
+
+/*
+ * Get the next token like COM_Parse does, but without copying it.
+ * Returns false at the end of the text.
+ */
+static bool nextToken(const char **pos, const char *end, entityToken_t *token)
+{
+    const char *s = *pos;
+
+    for (;;) {
+        while (s < end && *s && *s <= ' ') {
+            s++;
+        }
+        if (s + 1 < end && s[0] == '/' && s[1] == '/') {
+            while (s < end && *s && *s != '\n') {
+                s++;
+            }
+            continue;
+        }
+        break;
+    }
+
+    if (s >= end || *s == 0) {
+        *pos = s;
+        return false;
+    }
+
+    if (*s == '"') {
+        const char *start = ++s;
+        while (s < end && *s && *s != '"') {
+            s++;
+        }
+        token->s = start;
+        token->len = int(s - start);
+        token->quoted = true;
+        if (s < end && *s == '"') {
+            s++;
+        }
+    } else {
+        const char *start = s;
+        while (s < end && *s > ' ') {
+            s++;
+        }
+        token->s = start;
+        token->len = int(s - start);
+        token->quoted = false;
+    }
+
+    *pos = s;
+    return true;
+}
+
+static bool isBrace(const entityToken_t& token, char c)
+{
+    return !token.quoted && token.len == 1 && token.s[0] == c;
+}
+
+bool parseEntities(const char *text, int length, const char *name, entityList_t *list)
+{
+    if (length > MAX_MAP_ENTSTRING) {
+        fprintf(stderr, "Entity string too long in %s\n", name);
+        return false;
+    }
+
+    const char *pos = text;
+    const char *end = text + length;
+    entityToken_t token;
+
+    while (nextToken(&pos, end, &token)) {
+        if (!isBrace(token, '{')) {
+            fprintf(stderr, "Found '%.*s' when expecting { in %s\n", token.len, token.s, name);
+            return false;
+        }
+        if (list->entities.size() >= MAX_MAP_ENTITIES) {
+            fprintf(stderr, "Too many entities in %s\n", name);
+            return false;
+        }
+
+        entityDef_t ent;
+        ent.firstpair = int(list->pairs.size());
+        ent.numpairs = 0;
+
+        for (;;) {
+            entityToken_t key, value;
+            if (!nextToken(&pos, end, &key)) {
+                fprintf(stderr, "EOF without closing brace in %s\n", name);
+                return false;
+            }
+            if (isBrace(key, '}')) {
+                break;
+            }
+            if (!nextToken(&pos, end, &value)) {
+                fprintf(stderr, "EOF without closing brace in %s\n", name);
+                return false;
+            }
+            if (isBrace(value, '}')) {
+                fprintf(stderr, "Closing brace without data in %s\n", name);
+                return false;
+            }
+            if (key.len >= MAX_KEY || value.len >= MAX_VALUE) {
+                fprintf(stderr, "Too long key or value '%.*s' in %s\n", key.len, key.s, name);
+                return false;
+            }
+
+            entityPair_t pair;
+            pair.key = key.s;
+            pair.keylen = key.len;
+            pair.value = value.s;
+            pair.valuelen = value.len;
+            list->pairs.push_back(pair);
+            ent.numpairs++;
+        }
+
+        list->entities.push_back(ent);
+    }
+
+    return true;
+}
+
+const entityPair_t *findEntityKey(const entityList_t *list, int entity, const char *key)
+{
+    const entityDef_t& ent = list->entities[entity];
+    int keylen = int(strlen(key));
+    for (int i = 0; i < ent.numpairs; i++) {
+        const entityPair_t *pair = &list->pairs[ent.firstpair + i];
+        if (pair->keylen == keylen && strncmp(pair->key, key, keylen) == 0) {
+            return pair;
+        }
+    }
+    return NULL;
+}
+
+char *loadEntities(const fileEntry& entry, entityList_t *list)
+{
+    bspFile_t bsp;
+    if (!openBsp(entry, &bsp)) {
+        return NULL;
+    }
+
+    int length;
+    char *text = (char *)loadBspLump(&bsp, LUMP_ENTITIES, 1, &length);
+    if (text == NULL) {
+        return NULL;
+    }
+
+    if (!parseEntities(text, length, entry.name, list)) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+static bool writeEntitiesJson(const char *path, const entityList_t& list)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return false;
+    }
+
+    fputs("[\n", f);
+    for (size_t i = 0; i < list.entities.size(); i++) {
+        const entityDef_t& ent = list.entities[i];
+        fputs("  {", f);
+        for (int j = 0; j < ent.numpairs; j++) {
+            const entityPair_t& pair = list.pairs[ent.firstpair + j];
+            fputs(j ? ", " : " ", f);
+            writeJsonString(f, pair.key, pair.keylen);
+            fputs(": ", f);
+            writeJsonString(f, pair.value, pair.valuelen);
+        }
+        fputs(i + 1 < list.entities.size() ? " },\n" : " }\n", f);
+    }
+    fputs("]\n", f);
+
+    bool r = !ferror(f);
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+static bool writeEntitiesBinary(const char *path, const entityList_t& list)
+{
+    std::vector<dentity_t> ents(list.entities.size());
+    std::vector<dentpair_t> pairs(list.pairs.size());
+    std::vector<char> strings;
+
+    for (size_t i = 0; i < list.entities.size(); i++) {
+        ents[i].firstpair = LittleLong(list.entities[i].firstpair);
+        ents[i].numpairs = LittleLong(list.entities[i].numpairs);
+    }
+    for (size_t i = 0; i < list.pairs.size(); i++) {
+        const entityPair_t& pair = list.pairs[i];
+        pairs[i].key = LittleLong(int(strings.size()));
+        strings.insert(strings.end(), pair.key, pair.key + pair.keylen);
+        strings.push_back(0);
+        pairs[i].value = LittleLong(int(strings.size()));
+        strings.insert(strings.end(), pair.value, pair.value + pair.valuelen);
+        strings.push_back(0);
+    }
+
+    dentheader_t header;
+    header.ident = LittleLong(IDENTHEADER);
+    header.version = LittleLong(ENTITY_VERSION);
+    header.numentities = LittleLong(int(ents.size()));
+    header.numpairs = LittleLong(int(pairs.size()));
+    header.stringslen = LittleLong(int(strings.size()));
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return false;
+    }
+
+    bool r = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(ents.data(), sizeof(dentity_t), ents.size(), f) == ents.size() &&
+        fwrite(pairs.data(), sizeof(dentpair_t), pairs.size(), f) == pairs.size() &&
+        fwrite(strings.data(), 1, strings.size(), f) == strings.size();
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool exportEntities(const char *outPath, entityFormat_t format, const std::vector<bool>& selected)
+{
+    std::vector<const fileEntry *> maps;
+    findSelectedMaps(selected, maps);
+
+    bool r = parallelFor(int(maps.size()), [&](int i) {
+        const fileEntry& entry = *maps[i];
+        entityList_t list;
+        char *text = loadEntities(entry, &list);
+        if (text == NULL) {
+            return false;
+        }
+
+        char fullpath[1024];
+        bool ok = false;
+        if (format == ENTS_JSON) {
+            ok = createOutputPath(outPath, entry.name, ".ents.json", fullpath, sizeof(fullpath)) &&
+                writeEntitiesJson(fullpath, list);
+        } else {
+            ok = createOutputPath(outPath, entry.name, ".ents", fullpath, sizeof(fullpath)) &&
+                writeEntitiesBinary(fullpath, list);
+        }
+        free(text);
+        return ok;
+    });
+
+    printf("Entities: %lu maps\n", maps.size());
+    return r;
+}
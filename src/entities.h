@@ -0,0 +1,110 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  BSP entity lump parsing and export
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_ENTITIES_H
+#define Q2UNPACK_ENTITIES_H
+
+#include "common.h"
+
+/* Keys and values point into the parsed text, they are not copied
+ * and not terminated. */
+typedef struct
+{
+    const char *key;
+    int keylen;
+    const char *value;
+    int valuelen;
+} entityPair_t;
+
+typedef struct
+{
+    int firstpair;
+    int numpairs;
+} entityDef_t;
+
+typedef struct
+{
+    std::vector<entityDef_t> entities;
+    std::vector<entityPair_t> pairs;
+} entityList_t;
+
+/* Binary entity table written with --entities bin:
+ * header, entity table, pair table and the string table. Pairs refer
+ * to NUL terminated strings by their offset in the string table. */
+
+#define IDENTHEADER (('T' << 24) + ('N' << 16) + ('E' << 8) + 'Q') /* little-endian "QENT" */
+#define ENTITY_VERSION 1
+
+typedef struct
+{
+    int ident;
+    int version;
+    int numentities;
+    int numpairs;
+    int stringslen;
+} dentheader_t;
+
+typedef struct
+{
+    int firstpair;
+    int numpairs;
+} dentity_t;
+
+typedef struct
+{
+    int key;
+    int value;
+} dentpair_t;
+
+typedef enum
+{
+    ENTS_JSON,
+    ENTS_BINARY
+} entityFormat_t;
+
+/*
+ * Parse an entity string to key / value records. The text is not
+ * modified and must outlive the list.
+ */
+bool parseEntities(const char *text, int length, const char *name, entityList_t *list);
+
+/*
+ * Find the value of a key in an entity. Returns NULL if not found.
+ */
+const entityPair_t *findEntityKey(const entityList_t *list, int entity, const char *key);
+
+/*
+ * Load and parse the entity lump of a BSP entry. The returned text
+ * buffer owns the strings of the list and must be freed by the caller.
+ */
+char *loadEntities(const fileEntry& entry, entityList_t *list);
+
+/*
+ * Write the entities of the selected maps next to the extracted BSPs.
+ */
+bool exportEntities(const char *outPath, entityFormat_t format, const std::vector<bool>& selected);
+
+#endif
@@ -0,0 +1,124 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <algorithm>
+#include "filter.h"
+
+/*
+ * Match a lowercased glob against a lowercased name.
+ */
+static bool globMatch(const char *p, const char *s)
+{
+    for (; *p; p++, s++) {
+        if (p[0] == '*' && p[1] == '*') {
+            for (p += 2; *p == '*'; p++) {
+            }
+            /* the slash after the stars may match no directories at all */
+            if (*p == '/' && globMatch(p + 1, s)) {
+                return true;
+            }
+            for (const char *t = s; ; t++) {
+                if (globMatch(p, t)) {
+                    return true;
+                }
+                if (*t == 0) {
+                    return false;
+                }
+            }
+        }
+        if (*p == '*') {
+            for (const char *t = s; ; t++) {
+                if (globMatch(p + 1, t)) {
+                    return true;
+                }
+                if (*t == 0 || *t == '/') {
+                    return false;
+                }
+            }
+        }
+        if (*s == 0 || (*p == '?' ? *s == '/' : *p != *s)) {
+            return false;
+        }
+    }
+    return *s == 0;
+}
+
+bool addFilter(std::vector<entryFilter_t>& filters, const char *pattern, bool exclude)
+{
+    entryFilter_t filter;
+    filter.exclude = exclude;
+    filter.regex = strncmp(pattern, "re:", 3) == 0;
+    filter.basename = !filter.regex && strchr(pattern, '/') == NULL;
+    if (filter.regex) {
+        try {
+            filter.re = std::regex(pattern + 3, std::regex::ECMAScript | std::regex::icase | std::regex::optimize);
+        } catch (const std::regex_error& e) {
+            fprintf(stderr, "Bad pattern %s: %s\n", pattern, e.what());
+            return false;
+        }
+    } else {
+        filter.glob = lowerName(pattern);
+    }
+    filters.push_back(filter);
+    return true;
+}
+
+static bool patternMatch(const entryFilter_t& filter, const std::string& name)
+{
+    if (filter.regex) {
+        return std::regex_match(name, filter.re);
+    }
+    if (filter.basename) {
+        size_t slash = name.rfind('/');
+        return globMatch(filter.glob.c_str(), name.c_str() + (slash == std::string::npos ? 0 : slash + 1));
+    }
+    return globMatch(filter.glob.c_str(), name.c_str());
+}
+
+bool filterMatch(const std::vector<entryFilter_t>& filters, const char *name)
+{
+    std::string lower = lowerName(name);
+    bool includes = false;
+    bool included = false;
+    for (const entryFilter_t& filter : filters) {
+        if (filter.exclude) {
+            if (patternMatch(filter, lower)) {
+                return false;
+            }
+        } else {
+            includes = true;
+            included = included || patternMatch(filter, lower);
+        }
+    }
+    return included || !includes;
+}
+
+void filterEntries(const std::vector<entryFilter_t>& filters)
+{
+    if (filters.empty()) {
+        return;
+    }
+    size_t before = entries.size();
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const fileEntry& entry) {
+        return !filterMatch(filters, entry.name);
+    }), entries.end());
+    printf("Filtered: %lu of %lu files\n", entries.size(), before);
+}
@@ -0,0 +1,66 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Include and exclude patterns for the entry names
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_FILTER_H
+#define Q2UNPACK_FILTER_H
+
+#include <string>
+#include <regex>
+#include "common.h"
+
+/* Patterns are globs where "*" and "?" stay within a directory and
+ * "**" crosses them. A glob without a slash is matched against the
+ * file name only, so "*.wav" finds sounds anywhere. Patterns starting
+ * with "re:" are ECMAScript regular expressions matched against the
+ * whole name. Matching ignores case. */
+
+typedef struct
+{
+    bool exclude;
+    bool regex;
+    bool basename;
+    std::string glob;
+    std::regex re;
+} entryFilter_t;
+
+/*
+ * Parse and add a pattern. Returns false for a bad regular expression.
+ */
+bool addFilter(std::vector<entryFilter_t>& filters, const char *pattern, bool exclude);
+
+/*
+ * A name passes when it matches an include pattern, or there are none,
+ * and matches no exclude pattern.
+ */
+bool filterMatch(const std::vector<entryFilter_t>& filters, const char *name);
+
+/*
+ * Drop the entries not passing the filters from the table, so nothing
+ * later reads or writes them.
+ */
+void filterEntries(const std::vector<entryFilter_t>& filters);
+
+#endif
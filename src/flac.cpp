@@ -0,0 +1,552 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include "flac.h"
+
+#define MAX_FIXED_ORDER 4
+#define MAX_LPC_ORDER 12
+#define LPC_PRECISION 15
+#define MAX_PARTITION_ORDER 8
+#define MAX_RICE_PARAM 14
+
+#define SUBFRAME_CONSTANT 0
+#define SUBFRAME_VERBATIM 1
+#define SUBFRAME_FIXED 2
+#define SUBFRAME_LPC 3
+
+#define CHANNEL_INDEPENDENT 1
+#define CHANNEL_LEFT_SIDE 8
+#define CHANNEL_SIDE_RIGHT 9
+#define CHANNEL_MID_SIDE 10
+
+typedef struct
+{
+    std::vector<byte>& out;
+    uint64_t acc;
+    int bits;
+} bitWriter_t;
+
+/* Chosen coding of one subframe */
+typedef struct
+{
+    int type;
+    int order;
+    int shift;
+    int coefs[MAX_LPC_ORDER];
+    int partitionOrder;
+    int params[1 << MAX_PARTITION_ORDER];
+    long bits;
+    std::vector<int32_t> residual;
+} subframe_t;
+
+static void putBits(bitWriter_t *bw, uint32_t v, int n)
+{
+    if (n == 0) {
+        return;
+    }
+    bw->acc = (bw->acc << n) | (v & (n == 32 ? 0xffffffffu : (1u << n) - 1));
+    bw->bits += n;
+    while (bw->bits >= 8) {
+        bw->bits -= 8;
+        bw->out.push_back(byte(bw->acc >> bw->bits));
+    }
+}
+
+/* zigzag, branchless so the sums vectorize */
+static inline uint32_t fold(int32_t r)
+{
+    return (uint32_t(r) << 1) ^ uint32_t(r >> 31);
+}
+
+static void putRice(bitWriter_t *bw, int32_t r, int k)
+{
+    uint32_t u = fold(r);
+    uint32_t q = u >> k;
+    while (q >= 32) {
+        putBits(bw, 0, 32);
+        q -= 32;
+    }
+    putBits(bw, 1, q + 1);
+    putBits(bw, u, k);
+}
+
+static void alignBits(bitWriter_t *bw)
+{
+    if (bw->bits > 0) {
+        putBits(bw, 0, 8 - bw->bits);
+    }
+}
+
+static byte crc8(const byte *data, size_t len)
+{
+    byte crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x80) ? byte((crc << 1) ^ 0x07) : byte(crc << 1);
+        }
+    }
+    return crc;
+}
+
+typedef struct crc16Table_s
+{
+    uint16_t table[256];
+
+    crc16Table_s()
+    {
+        for (int i = 0; i < 256; i++) {
+            uint16_t c = uint16_t(i << 8);
+            for (int j = 0; j < 8; j++) {
+                c = (c & 0x8000) ? uint16_t((c << 1) ^ 0x8005) : uint16_t(c << 1);
+            }
+            table[i] = c;
+        }
+    }
+} crc16Table_t;
+
+static uint16_t crc16(const byte *data, size_t len)
+{
+    static const crc16Table_t crc16Table;
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = uint16_t((crc << 8) ^ crc16Table.table[(crc >> 8) ^ data[i]]);
+    }
+    return crc;
+}
+
+/*
+ * Pick the partition order and Rice parameters for a residual. The
+ * sums of the finest partitions are merged for the coarser orders and
+ * the bit count is estimated from them.
+ */
+static void chooseRice(subframe_t *sf, int blocksize)
+{
+    int maxorder = 0;
+    while (maxorder < MAX_PARTITION_ORDER && (blocksize & (1 << maxorder)) == 0 &&
+           (blocksize >> (maxorder + 1)) > sf->order) {
+        maxorder++;
+    }
+
+    uint64_t sums[2 << MAX_PARTITION_ORDER];
+    int parts = 1 << maxorder;
+    int psize = blocksize >> maxorder;
+    const int32_t *res = sf->residual.data();
+    for (int part = 0; part < parts; part++) {
+        int count = part == 0 ? psize - sf->order : psize;
+        uint64_t sum = 0;
+        for (int j = 0; j < count; j++) {
+            sum += fold(*res++);
+        }
+        sums[part] = sum;
+    }
+
+    long best = -1;
+    for (int p = maxorder; p >= 0; p--) {
+        parts = 1 << p;
+        psize = blocksize >> p;
+        if (p < maxorder) {
+            for (int part = 0; part < parts; part++) {
+                sums[part] = sums[part * 2] + sums[part * 2 + 1];
+            }
+        }
+
+        long bits = 0;
+        int params[1 << MAX_PARTITION_ORDER];
+        for (int part = 0; part < parts; part++) {
+            int count = part == 0 ? psize - sf->order : psize;
+            int k = 0;
+            while (k < MAX_RICE_PARAM && (uint64_t(count) << (k + 1)) < sums[part]) {
+                k++;
+            }
+            params[part] = k;
+            bits += 4 + long(count) * (k + 1) + long(sums[part] >> k);
+        }
+
+        if (best < 0 || bits < best) {
+            best = bits;
+            sf->partitionOrder = p;
+            memcpy(sf->params, params, parts * sizeof(int));
+        }
+    }
+    sf->bits += 2 + 4 + best;
+}
+
+static bool fixedResidual(const int32_t *x, int n, int order, std::vector<int32_t>& res)
+{
+    res.resize(n - order);
+    for (int i = order; i < n; i++) {
+        int64_t r;
+        switch (order) {
+        case 0: r = x[i]; break;
+        case 1: r = int64_t(x[i]) - x[i - 1]; break;
+        case 2: r = int64_t(x[i]) - 2 * int64_t(x[i - 1]) + x[i - 2]; break;
+        case 3: r = int64_t(x[i]) - 3 * int64_t(x[i - 1]) + 3 * int64_t(x[i - 2]) - x[i - 3]; break;
+        default: r = int64_t(x[i]) - 4 * int64_t(x[i - 1]) + 6 * int64_t(x[i - 2]) - 4 * int64_t(x[i - 3]) + x[i - 4]; break;
+        }
+        if (r > (1 << 30) || r < -(1 << 30)) {
+            return false;
+        }
+        res[i - order] = int32_t(r);
+    }
+    return true;
+}
+
+static bool lpcResidual(const int32_t *x, int n, const subframe_t *sf, std::vector<int32_t>& res)
+{
+    res.resize(n - sf->order);
+    for (int i = sf->order; i < n; i++) {
+        int64_t pred = 0;
+        for (int j = 0; j < sf->order; j++) {
+            pred += int64_t(sf->coefs[j]) * x[i - 1 - j];
+        }
+        int64_t r = x[i] - (pred >> sf->shift);
+        if (r > (1 << 30) || r < -(1 << 30)) {
+            return false;
+        }
+        res[i - sf->order] = int32_t(r);
+    }
+    return true;
+}
+
+/*
+ * Levinson-Durbin recursion, lpc[order - 1] gets the predictor of
+ * each order up to maxorder. Returns the highest usable order.
+ */
+static int computeLpc(const double *autoc, int maxorder, double lpc[][MAX_LPC_ORDER])
+{
+    double err = autoc[0];
+    double a[MAX_LPC_ORDER];
+    for (int i = 0; i < maxorder; i++) {
+        if (err <= 0) {
+            return i;
+        }
+        double r = -autoc[i + 1];
+        for (int j = 0; j < i; j++) {
+            r -= a[j] * autoc[i - j];
+        }
+        r /= err;
+
+        a[i] = r;
+        for (int j = 0; j < i / 2; j++) {
+            double tmp = a[j];
+            a[j] += r * a[i - 1 - j];
+            a[i - 1 - j] += r * tmp;
+        }
+        if (i & 1) {
+            a[i / 2] += a[i / 2] * r;
+        }
+        err *= 1.0 - r * r;
+
+        for (int j = 0; j <= i; j++) {
+            lpc[i][j] = -a[j];
+        }
+    }
+    return maxorder;
+}
+
+static void quantizeLpc(const double *lpc, int order, subframe_t *sf)
+{
+    double cmax = 0;
+    for (int i = 0; i < order; i++) {
+        if (fabs(lpc[i]) > cmax) {
+            cmax = fabs(lpc[i]);
+        }
+    }
+
+    int log2cmax = 0;
+    frexp(cmax, &log2cmax);
+    int shift = LPC_PRECISION - 1 - log2cmax;
+    shift = shift > 15 ? 15 : shift < 0 ? 0 : shift;
+
+    /* carry the rounding error to the next coefficient */
+    int qmax = (1 << (LPC_PRECISION - 1)) - 1;
+    double error = 0;
+    for (int i = 0; i < order; i++) {
+        error += lpc[i] * (1 << shift);
+        long q = lround(error);
+        q = q > qmax ? qmax : q < -qmax - 1 ? -qmax - 1 : q;
+        error -= q;
+        sf->coefs[i] = int(q);
+    }
+    sf->order = order;
+    sf->shift = shift;
+}
+
+/*
+ * Find the cheapest coding for one channel of a block.
+ */
+static void analyzeSubframe(const int32_t *x, int n, int bps, subframe_t *best)
+{
+    best->type = SUBFRAME_VERBATIM;
+    best->order = 0;
+    best->bits = 8 + long(n) * bps;
+    best->residual.clear();
+
+    bool constant = true;
+    for (int i = 1; i < n && constant; i++) {
+        constant = x[i] == x[0];
+    }
+    if (constant) {
+        best->type = SUBFRAME_CONSTANT;
+        best->bits = 8 + bps;
+        return;
+    }
+
+    subframe_t sf;
+    for (int order = 0; order <= MAX_FIXED_ORDER && order < n; order++) {
+        if (!fixedResidual(x, n, order, sf.residual)) {
+            continue;
+        }
+        sf.type = SUBFRAME_FIXED;
+        sf.order = order;
+        sf.bits = 8 + long(order) * bps;
+        chooseRice(&sf, n);
+        if (sf.bits < best->bits) {
+            *best = sf;
+        }
+    }
+
+    int maxorder = n > MAX_LPC_ORDER * 2 ? MAX_LPC_ORDER : 0;
+    if (maxorder == 0) {
+        return;
+    }
+
+    /* autocorrelation of the block with a Welch window */
+    std::vector<double> w(n);
+    double half = (n - 1) * 0.5;
+    for (int i = 0; i < n; i++) {
+        double t = (i - half) / (half + 1);
+        w[i] = x[i] * (1.0 - t * t);
+    }
+    double autoc[MAX_LPC_ORDER + 1];
+    for (int lag = 0; lag <= maxorder; lag++) {
+        double s = 0;
+        for (int i = lag; i < n; i++) {
+            s += w[i] * w[i - lag];
+        }
+        autoc[lag] = s;
+    }
+
+    double lpc[MAX_LPC_ORDER][MAX_LPC_ORDER];
+    maxorder = computeLpc(autoc, maxorder, lpc);
+    static const int orders[] = {2, 4, 8, 12};
+    for (int o : orders) {
+        if (o > maxorder) {
+            break;
+        }
+        quantizeLpc(lpc[o - 1], o, &sf);
+        if (!lpcResidual(x, n, &sf, sf.residual)) {
+            continue;
+        }
+        sf.type = SUBFRAME_LPC;
+        sf.bits = 8 + long(o) * bps + 4 + 5 + long(o) * LPC_PRECISION;
+        chooseRice(&sf, n);
+        if (sf.bits < best->bits) {
+            *best = sf;
+        }
+    }
+}
+
+static void writeSubframe(bitWriter_t *bw, const subframe_t *sf, const int32_t *x, int n, int bps)
+{
+    switch (sf->type) {
+    case SUBFRAME_CONSTANT:
+        putBits(bw, 0, 8);
+        putBits(bw, uint32_t(x[0]), bps);
+        return;
+    case SUBFRAME_VERBATIM:
+        putBits(bw, 1 << 1, 8);
+        for (int i = 0; i < n; i++) {
+            putBits(bw, uint32_t(x[i]), bps);
+        }
+        return;
+    case SUBFRAME_FIXED:
+        putBits(bw, (0x08 | sf->order) << 1, 8);
+        break;
+    default:
+        putBits(bw, (0x20 | (sf->order - 1)) << 1, 8);
+        break;
+    }
+
+    for (int i = 0; i < sf->order; i++) {
+        putBits(bw, uint32_t(x[i]), bps);
+    }
+    if (sf->type == SUBFRAME_LPC) {
+        putBits(bw, LPC_PRECISION - 1, 4);
+        putBits(bw, uint32_t(sf->shift), 5);
+        for (int i = 0; i < sf->order; i++) {
+            putBits(bw, uint32_t(sf->coefs[i]), LPC_PRECISION);
+        }
+    }
+
+    putBits(bw, 0, 2); /* 4 bit Rice parameters */
+    putBits(bw, uint32_t(sf->partitionOrder), 4);
+    int parts = 1 << sf->partitionOrder;
+    int i = 0;
+    for (int part = 0; part < parts; part++) {
+        int count = (n >> sf->partitionOrder) - (part == 0 ? sf->order : 0);
+        int k = sf->params[part];
+        putBits(bw, uint32_t(k), 4);
+        for (int j = 0; j < count; j++, i++) {
+            putRice(bw, sf->residual[i], k);
+        }
+    }
+}
+
+static void putUtf8(bitWriter_t *bw, uint32_t v)
+{
+    if (v < 0x80) {
+        putBits(bw, v, 8);
+        return;
+    }
+    int bytes = v < 0x800 ? 2 : v < 0x10000 ? 3 : v < 0x200000 ? 4 : v < 0x4000000 ? 5 : 6;
+    int shift = (bytes - 1) * 6;
+    putBits(bw, ((0xff00 >> bytes) & 0xff) | (v >> shift), 8);
+    while (shift > 0) {
+        shift -= 6;
+        putBits(bw, 0x80 | ((v >> shift) & 0x3f), 8);
+    }
+}
+
+static int rateCode(int rate, int *extra, int *extrabits)
+{
+    static const int rates[] = {0, 88200, 176400, 192000, 8000, 16000, 22050, 24000,
+                                32000, 44100, 48000, 96000};
+    *extrabits = 0;
+    for (int i = 1; i < 12; i++) {
+        if (rates[i] == rate) {
+            return i;
+        }
+    }
+    if (rate < 65536) {
+        *extra = rate;
+        *extrabits = 16;
+        return 13;
+    }
+    return 0; /* from STREAMINFO */
+}
+
+void writeFlacHeader(const flacStream_t *stream, int minframe, int maxframe, std::vector<byte>& out)
+{
+    out.insert(out.end(), (const byte *)"fLaC", (const byte *)"fLaC" + 4);
+    bitWriter_t bw = {out, 0, 0};
+    putBits(&bw, 0x80, 8); /* last metadata block, STREAMINFO */
+    putBits(&bw, 34, 24);
+    putBits(&bw, FLAC_BLOCKSIZE, 16);
+    putBits(&bw, FLAC_BLOCKSIZE, 16);
+    putBits(&bw, uint32_t(minframe), 24);
+    putBits(&bw, uint32_t(maxframe), 24);
+    putBits(&bw, uint32_t(stream->rate), 20);
+    putBits(&bw, uint32_t(stream->channels - 1), 3);
+    putBits(&bw, uint32_t(stream->bps - 1), 5);
+    putBits(&bw, uint32_t(uint64_t(stream->samples) >> 32), 4);
+    putBits(&bw, uint32_t(stream->samples), 32);
+    for (int i = 0; i < 4; i++) {
+        putBits(&bw, 0, 32);
+    }
+}
+
+void encodeFlacFrame(const flacStream_t *stream, const int32_t *const *channels, int blocksize,
+                     unsigned framenum, std::vector<byte>& out)
+{
+    int bps = stream->bps;
+    const int32_t *signals[2] = {channels[0], stream->channels > 1 ? channels[1] : NULL};
+    int sbps[2] = {bps, bps};
+    subframe_t subframes[2];
+    int assignment = CHANNEL_INDEPENDENT;
+    std::vector<int32_t> mid, side;
+
+    if (stream->channels == 1) {
+        analyzeSubframe(signals[0], blocksize, bps, &subframes[0]);
+    } else {
+        mid.resize(blocksize);
+        side.resize(blocksize);
+        for (int i = 0; i < blocksize; i++) {
+            mid[i] = (channels[0][i] + channels[1][i]) >> 1;
+            side[i] = channels[0][i] - channels[1][i];
+        }
+
+        /* left, right, mid, side */
+        subframe_t sf[4];
+        analyzeSubframe(channels[0], blocksize, bps, &sf[0]);
+        analyzeSubframe(channels[1], blocksize, bps, &sf[1]);
+        analyzeSubframe(mid.data(), blocksize, bps, &sf[2]);
+        analyzeSubframe(side.data(), blocksize, bps + 1, &sf[3]);
+
+        long independent = sf[0].bits + sf[1].bits;
+        long leftside = sf[0].bits + sf[3].bits;
+        long sideright = sf[3].bits + sf[1].bits;
+        long midside = sf[2].bits + sf[3].bits;
+        long best = std::min(std::min(independent, leftside), std::min(sideright, midside));
+        int a = 0, b = 1;
+        if (best == independent) {
+            assignment = CHANNEL_INDEPENDENT;
+        } else if (best == leftside) {
+            assignment = CHANNEL_LEFT_SIDE;
+            b = 3;
+        } else if (best == sideright) {
+            assignment = CHANNEL_SIDE_RIGHT;
+            a = 3;
+        } else {
+            assignment = CHANNEL_MID_SIDE;
+            a = 2;
+            b = 3;
+        }
+        const int32_t *all[4] = {channels[0], channels[1], mid.data(), side.data()};
+        signals[0] = all[a];
+        signals[1] = all[b];
+        sbps[0] = a == 3 ? bps + 1 : bps;
+        sbps[1] = b == 3 ? bps + 1 : bps;
+        subframes[0] = sf[a];
+        subframes[1] = sf[b];
+    }
+
+    size_t start = out.size();
+    bitWriter_t bw = {out, 0, 0};
+    putBits(&bw, 0xfff8, 16); /* sync, fixed blocksize */
+
+    int bscode = blocksize == FLAC_BLOCKSIZE ? 12 : 7;
+    int extra = 0, extrabits = 0;
+    int rcode = rateCode(stream->rate, &extra, &extrabits);
+    putBits(&bw, uint32_t(bscode), 4);
+    putBits(&bw, uint32_t(rcode), 4);
+    putBits(&bw, stream->channels == 1 ? 0 : uint32_t(assignment), 4);
+    putBits(&bw, bps == 8 ? 1 : 4, 3);
+    putBits(&bw, 0, 1);
+    putUtf8(&bw, framenum);
+    if (bscode == 7) {
+        putBits(&bw, uint32_t(blocksize - 1), 16);
+    }
+    putBits(&bw, uint32_t(extra), extrabits);
+    putBits(&bw, crc8(&out[start], out.size() - start), 8);
+
+    for (int c = 0; c < stream->channels; c++) {
+        writeSubframe(&bw, &subframes[c], signals[c], blocksize, sbps[c]);
+    }
+    alignBits(&bw);
+
+    uint16_t crc = crc16(&out[start], out.size() - start);
+    putBits(&bw, crc, 16);
+}
@@ -0,0 +1,57 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  FLAC encoding
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_FLAC_H
+#define Q2UNPACK_FLAC_H
+
+#include "common.h"
+
+/* Samples per frame, the last frame of a stream may be shorter */
+#define FLAC_BLOCKSIZE 4096
+
+typedef struct
+{
+    int rate;
+    int channels; /* 1 or 2 */
+    int bps;      /* 8 or 16 */
+    long samples; /* per channel */
+} flacStream_t;
+
+/*
+ * Append the "fLaC" marker and the STREAMINFO block. The frame sizes
+ * may be 0 if unknown. The MD5 signature is left unset.
+ */
+void writeFlacHeader(const flacStream_t *stream, int minframe, int maxframe, std::vector<byte>& out);
+
+/*
+ * Encode one frame of blocksize samples from each channel and append
+ * it to out. The frames only depend on their number, so any number of
+ * them can be encoded at the same time.
+ */
+void encodeFlacFrame(const flacStream_t *stream, const int32_t *const *channels, int blocksize,
+                     unsigned framenum, std::vector<byte>& out);
+
+#endif
@@ -0,0 +1,390 @@
+/*
+* Copyright (C) 1997-2001 Id Software, Inc.
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include "bsp.h"
+#include "collision.h"
+#include "hulls.h"
+
+/* Large enough to cover any map */
+#define MAX_WORLD_COORD (128 * 1024)
+
+/* Points closer than this to a plane are on it */
+#define ON_EPSILON 0.01
+
+/* Coordinates this close to an integer are snapped to it */
+#define SNAP_EPSILON 0.01
+
+/* Vertices closer than this are welded */
+#define WELD_EPSILON 0.1
+
+typedef struct
+{
+    double v[3];
+} hullPoint_t;
+
+typedef std::vector<hullPoint_t> winding_t;
+
+typedef struct
+{
+    std::vector<dhull_t> hulls;
+    std::vector<dhullface_t> faces;
+    std::vector<float> verts;
+    std::vector<unsigned short> indices;
+} hullSet_t;
+
+static const struct
+{
+    const char *name;
+    int flag;
+} contentNames[] = {
+    {"solid", CONTENTS_SOLID},
+    {"window", CONTENTS_WINDOW},
+    {"aux", CONTENTS_AUX},
+    {"lava", CONTENTS_LAVA},
+    {"slime", CONTENTS_SLIME},
+    {"water", CONTENTS_WATER},
+    {"mist", CONTENTS_MIST},
+    {"areaportal", CONTENTS_AREAPORTAL},
+    {"playerclip", CONTENTS_PLAYERCLIP},
+    {"monsterclip", CONTENTS_MONSTERCLIP},
+    {"origin", CONTENTS_ORIGIN},
+    {"detail", CONTENTS_DETAIL},
+    {"translucent", CONTENTS_TRANSLUCENT},
+    {"ladder", CONTENTS_LADDER},
+};
+
+int parseContentsMask(const char *str)
+{
+    char *end;
+    long value = strtol(str, &end, 0);
+    if (end != str && *end == 0) {
+        return int(value);
+    }
+
+    int mask = 0;
+    const char *s = str;
+    while (*s) {
+        const char *e = strchr(s, ',');
+        size_t len = e ? size_t(e - s) : strlen(s);
+        bool found = false;
+        for (size_t i = 0; i < sizeof(contentNames) / sizeof(contentNames[0]); i++) {
+            if (strlen(contentNames[i].name) == len && strncmp(contentNames[i].name, s, len) == 0) {
+                mask |= contentNames[i].flag;
+                found = true;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Unknown contents '%.*s'\n", int(len), s);
+            return 0;
+        }
+        s += len;
+        if (*s == ',') {
+            s++;
+        }
+    }
+    return mask;
+}
+
+/*
+ * Create a huge square winding on a plane, after BaseWindingForPlane.
+ */
+static winding_t baseWinding(const double normal[3], double dist)
+{
+    /* find the major axis */
+    int x = -1;
+    double max = -1;
+    for (int i = 0; i < 3; i++) {
+        double v = fabs(normal[i]);
+        if (v > max) {
+            x = i;
+            max = v;
+        }
+    }
+
+    double vup[3] = {0, 0, 0};
+    if (x == 2) {
+        vup[0] = 1;
+    } else {
+        vup[2] = 1;
+    }
+
+    double v = vup[0] * normal[0] + vup[1] * normal[1] + vup[2] * normal[2];
+    double len = 0;
+    for (int i = 0; i < 3; i++) {
+        vup[i] -= v * normal[i];
+        len += vup[i] * vup[i];
+    }
+    len = sqrt(len);
+
+    double org[3], vright[3];
+    for (int i = 0; i < 3; i++) {
+        vup[i] /= len;
+        org[i] = normal[i] * dist;
+    }
+    vright[0] = vup[1] * normal[2] - vup[2] * normal[1];
+    vright[1] = vup[2] * normal[0] - vup[0] * normal[2];
+    vright[2] = vup[0] * normal[1] - vup[1] * normal[0];
+
+    winding_t w(4);
+    for (int i = 0; i < 3; i++) {
+        double u = vup[i] * MAX_WORLD_COORD;
+        double r = vright[i] * MAX_WORLD_COORD;
+        w[0].v[i] = org[i] - r + u;
+        w[1].v[i] = org[i] + r + u;
+        w[2].v[i] = org[i] + r - u;
+        w[3].v[i] = org[i] - r - u;
+    }
+    return w;
+}
+
+/*
+ * Keep the part of the winding behind the plane, after ChopWinding.
+ */
+static void chopWinding(winding_t& in, const double normal[3], double dist)
+{
+    size_t n = in.size();
+    std::vector<double> dists(n + 1);
+    std::vector<int> sides(n + 1);
+    int counts[3] = {0, 0, 0};
+
+    /* determine sides for each point */
+    for (size_t i = 0; i < n; i++) {
+        double d = in[i].v[0] * normal[0] + in[i].v[1] * normal[1] + in[i].v[2] * normal[2] - dist;
+        dists[i] = d;
+        sides[i] = d > ON_EPSILON ? 0 : d < -ON_EPSILON ? 1 : 2;
+        counts[sides[i]]++;
+    }
+    dists[n] = dists[0];
+    sides[n] = sides[0];
+
+    if (!counts[0]) {
+        return; /* nothing in front */
+    }
+    if (!counts[1]) {
+        in.clear();
+        return;
+    }
+
+    winding_t out;
+    for (size_t i = 0; i < n; i++) {
+        const hullPoint_t& p1 = in[i];
+
+        if (sides[i] == 2) {
+            out.push_back(p1);
+            continue;
+        }
+        if (sides[i] == 1) {
+            out.push_back(p1);
+        }
+        if (sides[i + 1] == 2 || sides[i + 1] == sides[i]) {
+            continue;
+        }
+
+        /* generate a split point */
+        const hullPoint_t& p2 = in[(i + 1) % n];
+        double dot = dists[i] / (dists[i] - dists[i + 1]);
+        hullPoint_t mid;
+        for (int j = 0; j < 3; j++) {
+            /* avoid round off error when possible */
+            if (normal[j] == 1) {
+                mid.v[j] = dist;
+            } else if (normal[j] == -1) {
+                mid.v[j] = -dist;
+            } else {
+                mid.v[j] = p1.v[j] + dot * (p2.v[j] - p1.v[j]);
+            }
+        }
+        out.push_back(mid);
+    }
+    in.swap(out);
+}
+
+static int weldVertex(hullSet_t *set, const dhull_t& hull, const hullPoint_t& p)
+{
+    float v[3];
+    for (int i = 0; i < 3; i++) {
+        double r = floor(p.v[i] + 0.5);
+        v[i] = float(fabs(p.v[i] - r) < SNAP_EPSILON ? r : p.v[i]);
+    }
+
+    for (int i = 0; i < hull.numverts; i++) {
+        const float *o = &set->verts[(hull.firstvert + i) * 3];
+        if (fabs(o[0] - v[0]) < WELD_EPSILON && fabs(o[1] - v[1]) < WELD_EPSILON &&
+            fabs(o[2] - v[2]) < WELD_EPSILON) {
+            return i;
+        }
+    }
+    set->verts.insert(set->verts.end(), v, v + 3);
+    return hull.numverts;
+}
+
+/*
+ * Intersect the planes of a brush to a closed mesh. Returns false for
+ * degenerate brushes, which are left out.
+ */
+static bool buildHull(const collisionMap_t *map, int brushnum, hullSet_t *set)
+{
+    const cbrush_t *brush = &map->brushes[brushnum];
+
+    dhull_t hull;
+    hull.brushnum = brushnum;
+    hull.contents = brush->contents;
+    hull.firstface = int(set->faces.size());
+    hull.numfaces = 0;
+    hull.firstvert = int(set->verts.size() / 3);
+    hull.numverts = 0;
+    size_t firstindex = set->indices.size();
+
+    for (int i = 0; i < brush->numsides; i++) {
+        const cplane_t *plane = &map->planes[map->brushsides[brush->firstbrushside + i].planenum];
+        double normal[3] = {plane->normal[0], plane->normal[1], plane->normal[2]};
+        winding_t w = baseWinding(normal, plane->dist);
+
+        for (int j = 0; j < brush->numsides && !w.empty(); j++) {
+            if (i == j) {
+                continue;
+            }
+            int planenum = map->brushsides[brush->firstbrushside + j].planenum;
+            const cplane_t *clip = &map->planes[planenum];
+            if (clip == plane) {
+                continue;
+            }
+            double cn[3] = {clip->normal[0], clip->normal[1], clip->normal[2]};
+            chopWinding(w, cn, clip->dist);
+        }
+
+        /* bevel planes only touch the brush at an edge or corner */
+        if (w.size() < 3) {
+            continue;
+        }
+
+        dhullface_t face;
+        memcpy(face.normal, plane->normal, sizeof(face.normal));
+        face.dist = plane->dist;
+        face.firstindex = int(set->indices.size());
+        face.numindices = 0;
+        int last = -1;
+        for (const hullPoint_t& p : w) {
+            int v = weldVertex(set, hull, p);
+            if (v == hull.numverts) {
+                hull.numverts++;
+            }
+            if (v != last && (face.numindices == 0 || v != set->indices[face.firstindex])) {
+                set->indices.push_back((unsigned short)v);
+                face.numindices++;
+            }
+            last = v;
+        }
+        if (face.numindices < 3) {
+            set->indices.resize(face.firstindex);
+            continue;
+        }
+        set->faces.push_back(face);
+        hull.numfaces++;
+    }
+
+    if (hull.numfaces < 4 || hull.numverts < 4) {
+        set->faces.resize(hull.firstface);
+        set->verts.resize(hull.firstvert * 3);
+        set->indices.resize(firstindex);
+        return false;
+    }
+
+    for (int j = 0; j < 3; j++) {
+        hull.mins[j] = hull.maxs[j] = set->verts[hull.firstvert * 3 + j];
+    }
+    for (int i = 1; i < hull.numverts; i++) {
+        const float *v = &set->verts[(hull.firstvert + i) * 3];
+        for (int j = 0; j < 3; j++) {
+            if (v[j] < hull.mins[j]) {
+                hull.mins[j] = v[j];
+            }
+            if (v[j] > hull.maxs[j]) {
+                hull.maxs[j] = v[j];
+            }
+        }
+    }
+    set->hulls.push_back(hull);
+    return true;
+}
+
+static bool writeHulls(const char *path, const hullSet_t& set)
+{
+    dhullheader_t header;
+    header.ident = LittleLong(IDHULLHEADER);
+    header.version = LittleLong(HULL_VERSION);
+    header.numhulls = LittleLong(int(set.hulls.size()));
+    header.numfaces = LittleLong(int(set.faces.size()));
+    header.numverts = LittleLong(int(set.verts.size() / 3));
+    header.numindices = LittleLong(int(set.indices.size()));
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return false;
+    }
+
+    bool r = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(set.hulls.data(), sizeof(dhull_t), set.hulls.size(), f) == set.hulls.size() &&
+        fwrite(set.faces.data(), sizeof(dhullface_t), set.faces.size(), f) == set.faces.size() &&
+        fwrite(set.verts.data(), sizeof(float), set.verts.size(), f) == set.verts.size() &&
+        fwrite(set.indices.data(), sizeof(unsigned short), set.indices.size(), f) == set.indices.size();
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool exportHulls(const char *outPath, int contentsMask, const std::vector<bool>& selected)
+{
+    std::vector<const fileEntry *> maps;
+    findSelectedMaps(selected, maps);
+
+    bool r = parallelFor(int(maps.size()), [&](int i) {
+        const fileEntry& entry = *maps[i];
+        collisionMap_t map;
+        if (!loadCollisionMap(entry, &map)) {
+            return false;
+        }
+
+        hullSet_t set;
+        int skipped = 0;
+        for (size_t b = 0; b < map.brushes.size(); b++) {
+            if ((map.brushes[b].contents & contentsMask) && !buildHull(&map, int(b), &set)) {
+                skipped++;
+            }
+        }
+        if (skipped) {
+            printf("%s: skipped %d degenerate brushes\n", entry.name, skipped);
+        }
+
+        char fullpath[1024];
+        return createOutputPath(outPath, entry.name, ".hulls", fullpath, sizeof(fullpath)) &&
+            writeHulls(fullpath, set);
+    });
+
+    printf("Hulls: %lu maps\n", maps.size());
+    return r;
+}
@@ -0,0 +1,77 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Brush collision hull export
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_HULLS_H
+#define Q2UNPACK_HULLS_H
+
+#include "common.h"
+
+/* Binary hull file: header, hulls, faces, vertices and the face vertex
+ * indices. Face indices are relative to the first vertex of the hull,
+ * faces are wound clockwise when seen from outside like in the BSP. */
+
+#define IDHULLHEADER (('L' << 24) + ('U' << 16) + ('H' << 8) + 'Q') /* little-endian "QHUL" */
+#define HULL_VERSION 1
+
+typedef struct
+{
+    int ident;
+    int version;
+    int numhulls;
+    int numfaces;
+    int numverts;
+    int numindices;
+} dhullheader_t;
+
+typedef struct
+{
+    int brushnum;
+    int contents;
+    float mins[3], maxs[3];
+    int firstface, numfaces;
+    int firstvert, numverts;
+} dhull_t;
+
+typedef struct
+{
+    float normal[3];
+    float dist;
+    int firstindex, numindices;
+} dhullface_t;
+
+/*
+ * Parse a contents mask, either a number or names of the CONTENTS_*
+ * flags separated by commas ("solid,playerclip"). Returns 0 on error.
+ */
+int parseContentsMask(const char *str);
+
+/*
+ * Write the hulls of the brushes matching contentsMask of every selected
+ * map next to the extracted BSP.
+ */
+bool exportHulls(const char *outPath, int contentsMask, const std::vector<bool>& selected);
+
+#endif
@@ -24,8 +24,37 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <cstring>
+#include <chrono>
+#include <string>
+#include <set>
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
+#include <strings.h>
 #include <png.h>
 #include "files.h"
+#include "common.h"
+#include "entities.h"
+#include "collision.h"
+#include "depends.h"
+#include "minimap.h"
+#include "areas.h"
+#include "hulls.h"
+#include "zbsp.h"
+#include "animations.h"
+#include "sound.h"
+#include "cin.h"
+#include "pak.h"
+#include "delta.h"
+#include "checksum.h"
+#include "tar.h"
+#include "pk3.h"
+#include "filter.h"
+#include "stream.h"
+#include "store.h"
+#include "cache.h"
+#include "watch.h"
+#include "server.h"
 
 typedef struct
 {
@@ -42,18 +71,8 @@ typedef struct
     fsPackFile_t *files;
 } fsPack_t;
 
-#define LittleLong(x) x
-
-typedef struct
-{
-    char name[256];
-    FILE *file;
-    int offset;
-    long length;
-} fileEntry;
-
-static std::vector<fileEntry> entries;
-static uint32_t d_8to24table[256];
+std::vector<fileEntry> entries;
+uint32_t d_8to24table[256];
 
 /*
  * Takes an explicit (not game tree related) path to a pak file.
@@ -127,7 +146,9 @@ FS_LoadPAK(const char *packPath)
 }
 
 /*
- * Create entries for contents of PAK file.
+ * Create entries for contents of PAK file. They go in front of the
+ * list, so a pak loaded later overrides the ones before it and the
+ * loose files, like in the game.
  */
 static bool loadPak(const char *name) {
     fsPack_t *pak = FS_LoadPAK(name);
@@ -135,14 +156,17 @@ static bool loadPak(const char *name) {
         return false;
     }
 
+    std::vector<fileEntry> added;
     for (int i = 0; i < pak->numFiles; i++) {
         fileEntry entry;
         strcpy(entry.name, pak->files[i].name);
         entry.file = pak->pak;
         entry.offset = pak->files[i].offset;
         entry.length = pak->files[i].size;
-        entries.push_back(entry);
+        entry.source = pak->name;
+        added.push_back(entry);
     }
+    entries.insert(entries.begin(), added.begin(), added.end());
 
     return true;
 }
@@ -153,6 +177,27 @@ static void strtolower(char *str) {
     }
 }
 
+/*
+ * Create an entry for a file outside of the paks.
+ */
+static bool openLooseFile(const char *fullPath, const char *relPath, fileEntry *entry)
+{
+    FILE *f = fopen(fullPath, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open %s\n", fullPath);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long l = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    snprintf(entry->name, sizeof(entry->name), "%s", relPath);
+    entry->file = f;
+    entry->offset = 0;
+    entry->length = l;
+    entry->source = strdup(fullPath);
+    return true;
+}
+
 /*
  * Read a quake2 directory an create entries for files.
  */
@@ -164,80 +209,77 @@ static bool readDir(const char *basePath, const char *relPath) {
         return false;
     }
 
+    /* readdir order is arbitrary, go by name so pak1.pak loads after pak0.pak */
+    std::vector<std::pair<std::string, unsigned char>> items;
     dirent* dp;
     while ((dp = readdir(dir)) != NULL) {
         if (dp->d_namlen == 0 || dp->d_name[0] == '.') continue;
+        items.push_back(std::make_pair(std::string(dp->d_name), dp->d_type));
+    }
+    closedir(dir);
+    std::sort(items.begin(), items.end());
+
+    for (const auto& item : items) {
+        const char *name = item.first.c_str();
+        size_t namlen = item.first.size();
 
         char fullPath[4096];
-        sprintf(fullPath, "%s/%s", basePath, dp->d_name);
+        sprintf(fullPath, "%s/%s", basePath, name);
         char fullrelPath[4096];
         if (strlen(relPath) == 0) {
-            strcpy(fullrelPath, dp->d_name);
+            strcpy(fullrelPath, name);
         } else {
-            sprintf(fullrelPath, "%s/%s", relPath, dp->d_name);
+            sprintf(fullrelPath, "%s/%s", relPath, name);
         }
 
-        if (dp->d_type == DT_DIR) {
+        if (item.second == DT_DIR) {
             if (!readDir(fullPath, fullrelPath)) {
-                closedir(dir);
                 return false;
             }
-        } else if (dp->d_type == DT_REG) {
+        } else if (item.second == DT_REG) {
 
-            if (dp->d_namlen > 4 && strcmp(&dp->d_name[dp->d_namlen-4], ".pak") == 0) {
+            if (namlen > 4 && strcmp(&name[namlen-4], ".pak") == 0) {
                 if (!loadPak(fullPath)) {
-                    closedir(dir);
                     return false;
                 }
-            } else if (dp->d_namlen > 6 && strcmp(&dp->d_name[dp->d_namlen-6], ".dylib") == 0) {
+            } else if (namlen > 6 && strcmp(&name[namlen-6], ".dylib") == 0) {
                 // ignored
             } else {
-                FILE *f = fopen(fullPath, "rb");
-                fseek(f, 0, SEEK_END);
-                long l = ftell(f);
-                fseek(f, 0, SEEK_SET);
                 fileEntry entry;
-                strcpy(entry.name, fullrelPath);
-                entry.file = f;
-                entry.offset = 0;
-                entry.length = l;
+                if (!openLooseFile(fullPath, fullrelPath, &entry)) {
+                    return false;
+                }
                 entries.push_back(entry);
             }
 
         } else {
-            fprintf(stderr, "Skipping unknown file: %s\n", dp->d_name);
+            fprintf(stderr, "Skipping unknown file: %s\n", name);
         }
     }
-    closedir(dir);
     return true;
 }
 
 /*
  * Find an entry for specific file by name.
  */
-static fileEntry* findEntry(const char *path)
+fileEntry* findEntry(const char *path)
 {
-    for (int i = 0; i < entries.size(); i++) {
-        if (strcmp(entries[i].name, path) == 0) {
-            return &entries[i];
-        }
-    }
-    return NULL;
+    int i = lookupEntry(path);
+    return i < 0 ? NULL : &entries[i];
 }
 
 /*
  * Load palette from pcx file.
  */
-static bool loadPalette(const char *path, const char *outpath, const char *outfile)
+static bool loadPalette(const char *path, byte *palette)
 {
     fileEntry *entry = findEntry(path);
     if (entry == NULL) {
         fprintf(stderr, "Failed to find entry\n");
         return false;
     }
-    fseek(entry->file, entry->offset, SEEK_SET);
     pcx_t pcx;
-    if (fread(&pcx, sizeof(pcx), 1, entry->file) != 1) {
+    if (entry->length < long(sizeof(pcx) + 768) || !readEntry(*entry, 0, &pcx, sizeof(pcx))) {
         fprintf(stderr, "Failed to read entry\n");
         return false;
     }
@@ -248,9 +290,7 @@ static bool loadPalette(const char *path, const char *outpath, const char *outfi
         return false;
     }
 
-    byte palette[768];
-    fseek(entry->file, entry->offset + entry->length - 768, SEEK_SET);
-    if (fread(palette, 768, 1, entry->file) != 1) {
+    if (!readEntry(*entry, entry->length - 768, palette, 768)) {
         fprintf(stderr, "Failed to read palette\n");
         return false;
     }
@@ -265,11 +305,20 @@ static bool loadPalette(const char *path, const char *outpath, const char *outfi
     }
 
     d_8to24table[255] &= LittleLong(0xffffff); /* 255 is transparent */
+    return true;
+}
 
-    char fullpath[256];
-    snprintf(fullpath, 256, "%s/%s", outpath, outfile);
+/*
+ * Write the raw palette next to the unpacked files.
+ */
+static bool writePalette(const byte *palette, const char *outpath, const char *outfile)
+{
+    char fullpath[1024];
+    if (!createOutputPath(outpath, outfile, NULL, fullpath, sizeof(fullpath))) {
+        return false;
+    }
 
-    FILE *ofile = fopen(fullpath, "wb");
+    FILE *ofile = createOutputFile(fullpath);
     if (!ofile) {
         fprintf(stderr, "Failed to create %s\n", fullpath);
         return false;
@@ -307,39 +356,43 @@ static void splitPath(const fileEntry& entry, const char *outPath, char *path, c
     strcpy(filename, start + (*start == '/' ? 1 : 0));
 }
 
+static void pngWrite(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+    std::vector<byte> *out = (std::vector<byte> *)png_get_io_ptr(png_ptr);
+    out->insert(out->end(), data, data + length);
+}
+
+static void pngFlush(png_structp)
+{
+}
+
 /*
- * Create a PNG from pixel data.
+ * Encode pixel data as PNG to memory.
  */
-static bool writePng(const char *name, int width, int height, const uint32_t *data)
+bool encodePng(int width, int height, const uint32_t *data, std::vector<byte>& out)
 {
-    FILE *ofile = fopen(name, "wb");
-    if (!ofile) {
-        fprintf(stderr, "Failed to create %s\n", name);
-        return false;
-    }
-
     png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (png_ptr == NULL) {
         fprintf(stderr, "Could not allocate write struct\n");
-        fclose(ofile);
         return false;
     }
 
     png_infop info_ptr = png_create_info_struct(png_ptr);
     if (info_ptr == NULL) {
         fprintf(stderr, "Could not allocate info struct\n");
-        fclose(ofile);
+        png_destroy_write_struct(&png_ptr, NULL);
         return false;
     }
 
+    png_bytep *row_pointers = (png_bytep*) malloc(sizeof(png_bytep) * height);
     if (setjmp(png_jmpbuf(png_ptr))) {
         fprintf(stderr, "Error during png creation\n");
         png_destroy_write_struct(&png_ptr, &info_ptr);
-        fclose(ofile);
+        free(row_pointers);
         return false;
     }
 
-    png_init_io(png_ptr, ofile);
+    png_set_write_fn(png_ptr, &out, pngWrite, pngFlush);
 
     // Write header (8 bit colour depth)
     png_set_IHDR(png_ptr, info_ptr, width, height,
@@ -348,21 +401,6 @@ static bool writePng(const char *name, int width, int height, const uint32_t *da
 
     png_write_info(png_ptr, info_ptr);
 
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        fprintf(stderr, "Error during writing bytes\n");
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-        fclose(ofile);
-        return false;
-    }
-
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        fprintf(stderr, "Error during end of write\n");
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-        fclose(ofile);
-        return false;
-    }
-
-    png_bytep *row_pointers = (png_bytep*) malloc(sizeof(png_bytep) * height);
     for (int i = 0; i < height; i++) {
         row_pointers[i] = (png_bytep)&data[i * width];
     }
@@ -371,8 +409,31 @@ static bool writePng(const char *name, int width, int height, const uint32_t *da
 
     png_write_end(png_ptr, NULL);
 
+    png_destroy_write_struct(&png_ptr, &info_ptr);
     free(row_pointers);
-    fclose(ofile);
+    return true;
+}
+
+/*
+ * Create a PNG from pixel data.
+ */
+bool writePng(const char *name, int width, int height, const uint32_t *data)
+{
+    std::vector<byte> png;
+    if (!encodePng(width, height, data, png)) {
+        return false;
+    }
+
+    FILE *ofile = createOutputFile(name);
+    if (!ofile) {
+        fprintf(stderr, "Failed to create %s\n", name);
+        return false;
+    }
+    bool r = fwrite(png.data(), 1, png.size(), ofile) == png.size();
+    if (fclose(ofile) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", name);
+        return false;
+    }
     return true;
 }
 
@@ -384,7 +445,7 @@ static bool copyFile(const fileEntry& entry, const char *outPath) {
     strcat(fullpath, fname);
     strtolower(fullpath);
 
-    FILE *ofile = fopen(fullpath, "wb");
+    FILE *ofile = createOutputFile(fullpath);
     if (!ofile) {
         fprintf(stderr, "Failed to create %s\n", fullpath);
         return false;
@@ -500,18 +561,15 @@ static void FloodFillSkin(byte *skin, int skinwidth, int skinheight) {
 }
 
 /*
- * Load PCX and write PNG.
+ * Decode a PCX entry to RGBA with d_8to24table, flood filling the
+ * background of skins. Returns a malloc'd buffer or NULL on failure.
  */
-static bool convertPcx(const fileEntry& entry, const char *outPath, bool isSkin) {
-    char fullpath[1024];
-    char fname[32];
-    splitPath(entry, outPath, fullpath, fname);
-
-    fseek(entry.file, entry.offset, SEEK_SET);
+static uint32_t *loadPcx(const fileEntry& entry, bool isSkin, int *width, int *height)
+{
     pcx_t pcx;
-    if (fread(&pcx, sizeof(pcx), 1, entry.file) != 1) {
+    if (entry.length < long(sizeof(pcx)) || !readEntry(entry, 0, &pcx, sizeof(pcx))) {
         fprintf(stderr, "Failed to pcx header\n");
-        return false;
+        return NULL;
     }
 
     int pcx_width = pcx.xmax - pcx.xmin;
@@ -519,35 +577,36 @@ static bool convertPcx(const fileEntry& entry, const char *outPath, bool isSkin)
 
     if ((pcx.manufacturer != 0x0a) || (pcx.version != 5) ||
         (pcx.encoding != 1) || (pcx.bits_per_pixel != 8) ||
+        (pcx_width < 0) || (pcx_height < 0) ||
         (pcx_width >= 4096) || (pcx_height >= 4096)) {
         fprintf(stderr, "Bad pcx file %s\n", entry.name);
-        return false;
+        return NULL;
     }
 
     int datalen = int(entry.length - sizeof(pcx));
     byte *raw_b = (byte *)malloc(datalen);
-    if (fread(raw_b, datalen, 1, entry.file) != 1) {
+    if (!readEntry(entry, sizeof(pcx), raw_b, datalen)) {
         fprintf(stderr, "Failed to pcx data\n");
         free(raw_b);
-        return false;
+        return NULL;
     }
 
-
     int full_size = (pcx_height + 1) * (pcx_width + 1);
     uint8_t *out1 = (uint8_t *)malloc(full_size);
     const byte *raw = raw_b;
+    const byte *raw_end = raw_b + datalen;
 
     uint8_t *pix = out1;
     for (int y = 0; y <= pcx_height; y++, pix += pcx_width + 1) {
         for (int x = 0; x <= pcx_width; ) {
-            byte dataByte = *raw++;
+            byte dataByte = raw < raw_end ? *raw++ : 0;
             byte runLength = 1;
             if ((dataByte & 0xC0) == 0xC0) {
                 runLength = dataByte & 0x3F;
-                dataByte = *raw++;
+                dataByte = raw < raw_end ? *raw++ : 0;
             }
 
-            while (runLength-- > 0) {
+            while (runLength-- > 0 && x <= pcx_width) {
                 pix[x++] = dataByte;
             }
         }
@@ -562,84 +621,1054 @@ static bool convertPcx(const fileEntry& entry, const char *outPath, bool isSkin)
     for (int i = 0; i < full_size; i++) {
         out[i] = d_8to24table[out1[i]];
     }
+    free(out1);
+
+    *width = pcx_width + 1;
+    *height = pcx_height + 1;
+    return out;
+}
+
+/*
+ * Convert a PCX or WAL entry to PNG in memory, through the conversion
+ * cache when there is one.
+ */
+static bool encodeImage(const fileEntry& entry, bool isSkin, std::vector<byte>& png)
+{
+    bool pcx = hasExtension(entry.name, ".pcx");
+    uint64_t key = 0;
+    if (cacheEnabled()) {
+        byte *raw = loadEntry(entry);
+        if (raw == NULL) {
+            return false;
+        }
+        key = cacheKey(raw, size_t(entry.length), pcx ? (isSkin ? "pcx skin" : "pcx") : "wal");
+        free(raw);
+        if (cacheLookup(key, png)) {
+            return true;
+        }
+    }
+
+    int width, height;
+    uint32_t *pixels = pcx ? loadPcx(entry, isSkin, &width, &height) : loadWal(entry, &width, &height);
+    if (pixels == NULL) {
+        return false;
+    }
+    bool r = encodePng(width, height, pixels, png);
+    free(pixels);
+    if (r && cacheEnabled()) {
+        cacheStore(key, png);
+    }
+    return r;
+}
+
+/*
+ * Load PCX or WAL and write PNG.
+ */
+static bool convertImage(const fileEntry& entry, const char *outPath, bool isSkin) {
+    char fullpath[1024];
+    char fname[32];
+    splitPath(entry, outPath, fullpath, fname);
+
+    std::vector<byte> png;
+    if (!encodeImage(entry, isSkin, png)) {
+        return false;
+    }
 
     strcat(fullpath, fname);
     strtolower(fullpath);
     int l = strlen(fullpath);
     strcpy(&fullpath[l - 4], ".png");
 
-    bool r = writePng(fullpath, pcx_width + 1, pcx_height + 1, out);
-    free(out);
-    return r;
+    FILE *ofile = createOutputFile(fullpath);
+    if (!ofile) {
+        fprintf(stderr, "Failed to create %s\n", fullpath);
+        return false;
+    }
+    bool r = fwrite(png.data(), 1, png.size(), ofile) == png.size();
+    if (fclose(ofile) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", fullpath);
+        return false;
+    }
+    return true;
 }
 
+/*
+ * Produce the output file of an entry in memory, the way the normal
+ * unpack would write it. The name is left empty for the files that are
+ * not written at all.
+ */
+static bool unpackEntry(const fileEntry& entry, bool convert, std::string& name, std::vector<byte>& data)
+{
+    name = lowerName(entry.name);
+    data.clear();
+
+    if (convert && (hasExtension(entry.name, ".pcx") || hasExtension(entry.name, ".wal"))) {
+        bool isSkin = hasExtension(entry.name, ".pcx") &&
+            (strncmp(entry.name, "models", 6) == 0 || strncmp(entry.name, "players", 7) == 0);
+        name.replace(name.size() - 4, 4, ".png");
+        return encodeImage(entry, isSkin, data);
+    }
+    if (convert && hasExtension(entry.name, ".tga")) {
+        name.clear();
+        return true;
+    }
+
+    data.resize(entry.length);
+    return readEntry(entry, 0, data.data(), entry.length);
+}
 
 /*
-* Load WAL and write PNG.
-*/
+ * Narrow the entries down with --maps and --prune.
+ */
+static bool selectEntries(const char *mapList, bool prune, std::vector<bool>& selected)
+{
+    selected.assign(entries.size(), true);
+    if (mapList != NULL && !selectMaps(mapList, selected)) {
+        return false;
+    }
+    if (prune) {
+        std::vector<bool> unused;
+        if (!findUnused(unused)) {
+            return false;
+        }
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (unused[i]) {
+                selected[i] = false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Answer a server request: the file itself, or for a converted image
+ * the PNG of the PCX or WAL it comes from.
+ */
+static int resolveRequest(const std::string& path, bool convert, std::vector<byte>& data)
+{
+    int i = lookupEntry(path.c_str());
+    if (i >= 0) {
+        data.resize(entries[i].length);
+        return readEntry(entries[i], 0, data.data(), entries[i].length) ? 200 : 500;
+    }
+    if (!convert || !hasExtension(path.c_str(), ".png")) {
+        return 404;
+    }
+    std::string base = path.substr(0, path.size() - 4);
+    i = lookupEntry((base + ".pcx").c_str());
+    if (i < 0) {
+        i = lookupEntry((base + ".wal").c_str());
+    }
+    if (i < 0) {
+        return 404;
+    }
+    const fileEntry& entry = entries[i];
+    bool isSkin = hasExtension(entry.name, ".pcx") &&
+        (strncmp(entry.name, "models", 6) == 0 || strncmp(entry.name, "players", 7) == 0);
+    return encodeImage(entry, isSkin, data) ? 200 : 500;
+}
+
+typedef struct
+{
+    const char *inPath;
+    const char *outPath;
+    bool convert;
+    const std::vector<entryFilter_t> *filters;
+    const char *mapList;
+    bool prune;
+    bool sounds;
+    int soundRate;
+    bool soundNormalize;
+    soundFormat_t soundFormat;
+    bool cinematics;
+    bool zbsp;
+    bool entities;
+    entityFormat_t entityFormat;
+    bool areas;
+    int hullContents;
+    bool anims;
+    bool animSheets;
+    int minimapSize;
+    bool minimapLit;
+} unpackOptions_t;
+
+/*
+ * Remove a directory of generated files.
+ */
+static void removeOutputDir(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+    dirent *dp;
+    while ((dp = readdir(dir)) != NULL) {
+        if (dp->d_name[0] != '.') {
+            unlink((std::string(path) + "/" + dp->d_name).c_str());
+        }
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+/*
+ * Remove what was written for an entry that is gone.
+ */
+static void removeOutput(const unpackOptions_t& opts, const char *name)
+{
+    const char *ext = NULL;
+    if (opts.convert && (hasExtension(name, ".pcx") || hasExtension(name, ".wal"))) {
+        ext = ".png";
+    } else if (opts.convert && hasExtension(name, ".tga")) {
+        return;
+    } else if (opts.sounds && strncmp(name, "sound/", 6) == 0 && hasExtension(name, ".wav")) {
+        ext = opts.soundFormat == SOUND_FLAC ? ".flac" : ".wav";
+    } else if (opts.zbsp && strncmp(name, "maps/", 5) == 0 && hasExtension(name, ".bsp")) {
+        ext = ".bspz";
+    } else if (opts.cinematics && strncmp(name, "video/", 6) == 0 && hasExtension(name, ".cin")) {
+        char frames[1024];
+        if (createOutputPath(opts.outPath, name, "", frames, sizeof(frames))) {
+            removeOutputDir(frames);
+        }
+        ext = ".wav";
+    }
 
-static bool convertWal(const fileEntry& entry, const char *outPath) {
     char fullpath[1024];
-    char fname[32];
-    splitPath(entry, outPath, fullpath, fname);
+    if (createOutputPath(opts.outPath, name, ext, fullpath, sizeof(fullpath)) && unlink(fullpath) == 0) {
+        printf("Removed %s\n", fullpath);
+    }
 
-    fseek(entry.file, entry.offset, SEEK_SET);
-    miptex_t mt;
-    if (fread(&mt, sizeof(miptex_t), 1, entry.file) != 1) {
-        fprintf(stderr, "Failed to mip header\n");
+    /* and what the exporters wrote next to a map */
+    if (strncmp(name, "maps/", 5) == 0 && hasExtension(name, ".bsp")) {
+        static const char *exported[] = { ".ents.json", ".ents", ".areas", ".areas.dot", ".hulls", ".anims",
+                                          ".minimap.png" };
+        for (const char *e : exported) {
+            if (createOutputPath(opts.outPath, name, e, fullpath, sizeof(fullpath)) && unlink(fullpath) == 0) {
+                printf("Removed %s\n", fullpath);
+            }
+        }
+    }
+}
+
+/*
+ * Run the per map exporters again for the selected maps.
+ */
+static bool exportMaps(const unpackOptions_t& opts, const std::vector<bool>& selected)
+{
+    return (!opts.zbsp || exportCompressedMaps(opts.outPath, selected)) &&
+        (!opts.entities || exportEntities(opts.outPath, opts.entityFormat, selected)) &&
+        (!opts.areas || exportAreas(opts.outPath, selected)) &&
+        (opts.hullContents == 0 || exportHulls(opts.outPath, opts.hullContents, selected)) &&
+        (opts.minimapSize <= 0 || renderMinimaps(opts.outPath, opts.minimapSize, opts.minimapLit, selected));
+}
+
+/*
+ * Write the output of one entry again, the way the full unpack does.
+ */
+static bool updateOutput(const unpackOptions_t& opts, int index)
+{
+    const fileEntry& entry = entries[index];
+    std::vector<bool> only(entries.size(), false);
+    only[index] = true;
+    if (opts.convert && strcmp(entry.name, "pics/colormap.pcx") == 0) {
+        return true;
+    }
+    if (opts.sounds && strncmp(entry.name, "sound/", 6) == 0 && hasExtension(entry.name, ".wav")) {
+        return convertSounds(opts.outPath, only, opts.soundRate, opts.soundNormalize, opts.soundFormat);
+    }
+    if (opts.cinematics && strncmp(entry.name, "video/", 6) == 0 && hasExtension(entry.name, ".cin")) {
+        return decodeCinematics(opts.outPath, only);
+    }
+    if (strncmp(entry.name, "maps/", 5) == 0 && hasExtension(entry.name, ".bsp")) {
+        if (!exportMaps(opts, only)) {
+            return false;
+        }
+        if (opts.zbsp) {
+            return true;
+        }
+    }
+
+    std::string name;
+    std::vector<byte> data;
+    char fullpath[1024];
+    if (!unpackEntry(entry, opts.convert, name, data)) {
+        return false;
+    }
+    if (name.empty()) {
+        return true;
+    }
+    if (!createOutputPath(opts.outPath, name.c_str(), NULL, fullpath, sizeof(fullpath))) {
+        return false;
+    }
+    FILE *f = createOutputFile(fullpath);
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", fullpath);
+        return false;
+    }
+    bool r = fwrite(data.data(), 1, data.size(), f) == data.size();
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", fullpath);
+        return false;
+    }
+    printf("Updated %s\n", fullpath);
+    return true;
+}
+
+/*
+ * Bring the entries and the output up to date with a batch of changed
+ * files. Changed entries keep their place so shadowing stays the same,
+ * new paks go first and new loose files last, as when loading.
+ */
+static bool applyChanges(const unpackOptions_t& opts, const std::vector<watchChange_t>& changes)
+{
+    std::set<std::string> affected;
+    for (const watchChange_t& change : changes) {
+        std::string full = std::string(opts.inPath) + "/" + change.path;
+        const char *path = change.path.c_str();
+        if (hasExtension(path, ".dylib")) {
+            continue;
+        }
+
+        /* drop the old entries of the file, or of everything under a removed directory */
+        size_t pos = entries.size();
+        FILE *closed = NULL;
+        for (size_t i = entries.size(); i-- > 0; ) {
+            const char *source = entries[i].source;
+            bool under = change.removed && strncmp(source, full.c_str(), full.size()) == 0 && source[full.size()] == '/';
+            if (strcmp(source, full.c_str()) != 0 && !under) {
+                continue;
+            }
+            affected.insert(entries[i].name);
+            if (entries[i].file != closed) {
+                fclose(entries[i].file);
+                closed = entries[i].file;
+            }
+            entries.erase(entries.begin() + i);
+            pos = i;
+        }
+        if (change.removed) {
+            continue;
+        }
+
+        std::vector<fileEntry> added;
+        if (hasExtension(path, ".pak")) {
+            if (pos == entries.size()) {
+                pos = 0;
+            }
+            fsPack_t *pak = FS_LoadPAK(full.c_str());
+            for (int i = 0; pak != nullptr && i < pak->numFiles; i++) {
+                fileEntry entry;
+                strcpy(entry.name, pak->files[i].name);
+                entry.file = pak->pak;
+                entry.offset = pak->files[i].offset;
+                entry.length = pak->files[i].size;
+                entry.source = pak->name;
+                added.push_back(entry);
+            }
+        } else {
+            fileEntry entry;
+            if (openLooseFile(full.c_str(), path, &entry)) {
+                added.push_back(entry);
+            }
+        }
+        for (const fileEntry& entry : added) {
+            if (filterMatch(*opts.filters, entry.name)) {
+                entries.insert(entries.begin() + pos++, entry);
+                affected.insert(entry.name);
+            }
+        }
+    }
+    resetEntryIndex();
+
+    std::vector<bool> selected;
+    if (!selectEntries(opts.mapList, opts.prune, selected)) {
+        return true;
+    }
+
+    /* a new palette changes every image */
+    if (opts.convert && affected.count("pics/colormap.pcx") && lookupEntry("pics/colormap.pcx") >= 0) {
+        byte palette[768];
+        if (loadPalette("pics/colormap.pcx", palette) && writePalette(palette, opts.outPath, "pics/colormap.bin")) {
+            for (const fileEntry& entry : entries) {
+                if (hasExtension(entry.name, ".pcx") || hasExtension(entry.name, ".wal")) {
+                    affected.insert(entry.name);
+                }
+            }
+        }
+    }
+
+    int updated = 0, removed = 0, failed = 0;
+    for (const std::string& name : affected) {
+        int i = lookupEntry(name.c_str());
+        if (i >= 0 && !selected[i]) {
+            i = -1;
+        }
+        if (i < 0) {
+            removeOutput(opts, name.c_str());
+            removed++;
+        } else if (updateOutput(opts, i)) {
+            updated++;
+        } else {
+            failed++; /* likely still being written, the next change retries */
+        }
+    }
+
+    /* the animation chains and the minimap colors come from all the textures */
+    bool textures = false, maps = false;
+    for (const std::string& name : affected) {
+        textures = textures || (strncmp(name.c_str(), "textures/", 9) == 0 && hasExtension(name.c_str(), ".wal"));
+        maps = maps || (strncmp(name.c_str(), "maps/", 5) == 0 && hasExtension(name.c_str(), ".bsp"));
+    }
+    if (opts.anims && (textures || maps) && !exportAnimations(opts.outPath, opts.animSheets, selected)) {
+        failed++;
+    }
+    if (opts.minimapSize > 0 && textures &&
+        !renderMinimaps(opts.outPath, opts.minimapSize, opts.minimapLit, selected)) {
+        failed++;
+    }
+    printf("Changes: %d updated, %d removed, %d failed\n", updated, removed, failed);
+    return true;
+}
+
+/*
+ * Take stdout for data and send everything else printed there, like the
+ * pak messages, to stderr. Returns the stream to write the data to.
+ */
+static FILE *takeStdout()
+{
+    int fd = dup(1);
+    FILE *out = fd >= 0 && dup2(2, 1) >= 0 ? fdopen(fd, "wb") : NULL;
+    if (out == NULL) {
+        fprintf(stderr, "Cannot write to stdout\n");
+    }
+    return out;
+}
+
+/*
+ * The selected, resolved entries going to an archive, in entry order.
+ */
+static void archiveFiles(bool convert, const std::vector<bool>& selected, std::vector<int>& files)
+{
+    files.clear();
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!selected[i] || lookupEntry(entries[i].name) != int(i)) {
+            continue;
+        }
+        if (convert && strcmp(entries[i].name, "pics/colormap.pcx") == 0) {
+            continue;
+        }
+        files.push_back(int(i));
+    }
+}
+
+/*
+ * How many unpacked files an archive writer may hold, a few per core.
+ */
+static int archiveWindow()
+{
+    int window = 4 * int(std::thread::hardware_concurrency());
+    return window < 8 ? 8 : window;
+}
+
+/*
+ * Write the selected files as a tar stream. The files are unpacked in
+ * parallel but written in entry order, holding at most a few per core.
+ */
+static bool writeTar(FILE *out, bool convert, const byte *palette, const std::vector<bool>& selected)
+{
+    if (palette != NULL && !writeTarMember(out, "pics/colormap.bin", palette, 768)) {
         return false;
     }
 
-    if ((mt.offsets[0] <= 0) || (mt.width <= 0) || (mt.height <= 0) ||
-        (((entry.length - mt.offsets[0]) / mt.height) < mt.width)) {
-        fprintf(stderr, "Bad mip file %s\n", entry.name);
+    std::vector<int> files;
+    archiveFiles(convert, selected, files);
+
+    int window = archiveWindow();
+    std::vector<std::string> names(window);
+    std::vector<std::vector<byte> > slots(window);
+    bool r = orderedParallelFor(int(files.size()), window, [&](int i) {
+        return unpackEntry(entries[files[i]], convert, names[i % window], slots[i % window]);
+    }, [&](int i) {
+        std::vector<byte>& data = slots[i % window];
+        bool r = names[i % window].empty() ||
+            writeTarMember(out, names[i % window].c_str(), data.data(), data.size());
+        std::vector<byte>().swap(data);
+        return r;
+    });
+    return r && finishTar(out);
+}
+
+/*
+ * Write the selected files to a pk3. Files are unpacked and deflated in
+ * parallel and appended in entry order. With storePng the PNGs, which
+ * are deflated already, are stored as they are.
+ */
+static bool writeArchivePk3(const char *path, bool convert, const byte *palette, bool storePng,
+                            const std::vector<bool>& selected)
+{
+    pk3_t pk3;
+    if (!openPk3(pk3, path)) {
         return false;
     }
 
-    strcat(fullpath, fname);
-    int l = strlen(fullpath);
-    strtolower(fullpath);
-    strcpy(&fullpath[l - 4], ".png");
+    std::vector<int> files;
+    archiveFiles(convert, selected, files);
+
+    int window = archiveWindow();
+    std::vector<pk3File_t> slots(window);
+    std::vector<std::vector<byte> > data(window);
+    bool r = true;
+    if (palette != NULL) {
+        pk3File_t file;
+        std::vector<byte> colormap(palette, palette + 768);
+        file.name = "pics/colormap.bin";
+        r = compressPk3File(file, colormap, false) && writePk3File(pk3, file, colormap);
+    }
+    r = r && orderedParallelFor(int(files.size()), window, [&](int i) {
+        pk3File_t& file = slots[i % window];
+        if (!unpackEntry(entries[files[i]], convert, file.name, data[i % window])) {
+            return false;
+        }
+        return file.name.empty() ||
+            compressPk3File(file, data[i % window], storePng && hasExtension(file.name.c_str(), ".png"));
+    }, [&](int i) {
+        bool r = slots[i % window].name.empty() || writePk3File(pk3, slots[i % window], data[i % window]);
+        std::vector<byte>().swap(data[i % window]);
+        return r;
+    });
+
+    if (!r) {
+        fclose(pk3.file);
+        return false;
+    }
+    if (!closePk3(pk3)) {
+        return false;
+    }
+    printf("Wrote %s: %lu files, %ld bytes\n", path, pk3.files.size(), pk3.offset);
+    return true;
+}
 
-    int fullsize = mt.width * mt.height;
-    byte *raw = (byte *)malloc(fullsize);
-    fseek(entry.file, entry.offset + mt.offsets[0], SEEK_SET);
-    if (fread(raw, fullsize, 1, entry.file) != 1) {
-        fprintf(stderr, "Failed to read mt data\n");
-        free(raw);
+/*
+ * Unpack the selected files to a content addressed store and link them
+ * to the output tree.
+ */
+static bool writeStore(const char *storePath, const char *outPath, bool convert, const byte *palette,
+                       const std::vector<bool>& selected)
+{
+    storeStats_t stats;
+    stats.files = stats.bytes = stats.newBlobs = stats.newBytes = stats.copies = 0;
+    if (palette != NULL &&
+        !storeFile(storePath, outPath, "pics/colormap.bin", std::vector<byte>(palette, palette + 768), stats)) {
         return false;
     }
 
-    uint32_t *out = (uint32_t *)malloc(fullsize * 4);
-    for (int i = 0; i < fullsize; i++) {
-        out[i] = d_8to24table[raw[i]];
+    std::vector<int> files;
+    archiveFiles(convert, selected, files);
+    bool r = parallelFor(int(files.size()), [&](int i) {
+        std::string name;
+        std::vector<byte> data;
+        return unpackEntry(entries[files[i]], convert, name, data) &&
+            (name.empty() || storeFile(storePath, outPath, name.c_str(), data, stats));
+    });
+    if (!r) {
+        return false;
     }
-    free(raw);
+    reportStore(stats);
+    return true;
+}
 
-    bool r = writePng(fullpath, mt.width, mt.height, out);
-    free(out);
-    return r;
+/*
+ * Copy a single file of a pak to stdout. Only the directory of that
+ * pak is read, not the whole game tree.
+ */
+static bool catPakEntry(const char *pakPath, const char *name)
+{
+    FILE *out = takeStdout();
+    if (out == NULL) {
+        return false;
+    }
+
+    fsPack_t *pak = FS_LoadPAK(pakPath);
+    if (pak == nullptr) {
+        return false;
+    }
+    for (int i = 0; i < pak->numFiles; i++) {
+        if (strcasecmp(pak->files[i].name, name) != 0) {
+            continue;
+        }
+        fileEntry entry;
+        strcpy(entry.name, pak->files[i].name);
+        entry.file = pak->pak;
+        entry.offset = pak->files[i].offset;
+        entry.length = pak->files[i].size;
+        entry.source = pak->name;
+        bool r = entry.offset >= 0 && entry.length >= 0 && streamEntry(entry, fileno(out));
+        fclose(out);
+        return r;
+    }
+    fprintf(stderr, "No %s in %s\n", name, pakPath);
+    return false;
 }
 
-int main(int argc, const char * argv[]) {
+/*
+ * Print every entry with where its data is, in search order. Shadowed
+ * entries are hidden by an earlier one of the same name.
+ */
+static bool listEntries(FILE *out, bool json)
+{
+    if (json) {
+        fputs("[\n", out);
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        const fileEntry& entry = entries[i];
+        bool shadowed = lookupEntry(entry.name) != int(i);
+        if (json) {
+            fputs("  { \"name\": ", out);
+            writeJsonString(out, entry.name, int(strlen(entry.name)));
+            fputs(", \"source\": ", out);
+            writeJsonString(out, entry.source, int(strlen(entry.source)));
+            fprintf(out, ", \"offset\": %d, \"length\": %ld, \"shadowed\": %s }%s\n", entry.offset,
+                    entry.length, shadowed ? "true" : "false", i + 1 < entries.size() ? "," : "");
+        } else {
+            fprintf(out, "%10d %10ld %c %s %s\n", entry.offset, entry.length, shadowed ? 'S' : '-', entry.name,
+                    entry.source);
+        }
+    }
+    if (json) {
+        fputs("]\n", out);
+    }
 
-    if (argc != 3 && argc != 4) {
-        fprintf(stderr, "Usage q2unpack [-nc] inpath outpath\n");
-        fprintf(stderr, " -nc: Do not convert to imagess\n");
-        return 1;
+    bool r = !ferror(out);
+    if (fclose(out) != 0 || !r) {
+        fprintf(stderr, "Failed to write the listing\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Read the input and drop the files the filters leave out, before
+ * anything else touches them. The palette is loaded first when asked
+ * for, so converting still works when the filters skip it. With
+ * hasPalette a missing palette is not an error, it tells whether one was
+ * loaded. A path of "-" reads a single pak from stdin.
+ */
+static bool readInput(const char *path, const std::vector<entryFilter_t>& filters, byte *palette,
+                      bool *hasPalette = NULL)
+{
+    bool r = strcmp(path, "-") == 0 ? spoolPakStream(0, "stdin") : readDir(path, "");
+    if (!r) {
+        return false;
+    }
+    resetEntryIndex(); /* the table may have been swapped for one of the same size */
+    if (palette != NULL) {
+        bool found = hasPalette == NULL || findEntry("pics/colormap.pcx") != NULL;
+        if (found && !loadPalette("pics/colormap.pcx", palette)) {
+            return false;
+        }
+        if (hasPalette != NULL) {
+            *hasPalette = found;
+        }
     }
+    filterEntries(filters);
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage q2unpack [options] inpath outpath\n");
+    fprintf(stderr, " An inpath of - reads a pak from stdin, spooling it to a temporary file\n");
+    fprintf(stderr, " -nc: Do not convert to imagess\n");
+    fprintf(stderr, " --entities json|bin: Export the entity lumps of the maps\n");
+    fprintf(stderr, " --areas: Export the area graphs of the maps\n");
+    fprintf(stderr, " --hulls solid,playerclip: Export the brushes of given contents as hulls\n");
+    fprintf(stderr, " --zbsp: Write maps as .bspz with separately compressed lumps\n");
+    fprintf(stderr, " --anims: Resolve the texture animation chains\n");
+    fprintf(stderr, " --anim-sheets: Also write each animation as a strip of frames\n");
+    fprintf(stderr, " --sound-rate rate: Resample sounds to 16 bit PCM at given rate\n");
+    fprintf(stderr, " --sound-normalize: Normalize the peak level of sounds\n");
+    fprintf(stderr, " --flac: Write sounds as FLAC\n");
+    fprintf(stderr, " --cin: Decode cinematics to PNG frames and WAV audio\n");
+    fprintf(stderr, " --maps base1,base2: Only unpack the files the maps need\n");
+    fprintf(stderr, " --prune: Do not unpack assets no map or model refers to\n");
+    fprintf(stderr, " --include pattern: Only use the files matching a glob, or a regex after re:\n");
+    fprintf(stderr, " --exclude pattern: Leave out the files matching a glob or regex, in any mode\n");
+    fprintf(stderr, " --cache dir: Keep converted images in dir and reuse them in later runs\n");
+    fprintf(stderr, " --cache-size mb: Size limit of the cache, the least recently used go first\n");
+    fprintf(stderr, " --watch: Keep running and update the output as the input files change\n");
+    fprintf(stderr, " --minimap size: Render a top-down image of each map\n");
+    fprintf(stderr, " --minimap-lit: Apply the lightmaps to the images\n");
+    fprintf(stderr, "Usage q2unpack --bench-trace count inpath\n");
+    fprintf(stderr, " Run count random traces against every map\n");
+    fprintf(stderr, "Usage q2unpack --unused inpath\n");
+    fprintf(stderr, " List assets no map or model refers to\n");
+    fprintf(stderr, "Usage q2unpack --pak outfile [--maps list] [--prune] inpath\n");
+    fprintf(stderr, " Write the resolved files to a new pak, ordered for loading\n");
+    fprintf(stderr, "Usage q2unpack --delta oldpath outfile inpath\n");
+    fprintf(stderr, " Write the files added or changed since oldpath to a pak\n");
+    fprintf(stderr, "Usage q2unpack --checksum manifest [-nc] [--maps list] [--prune] inpath\n");
+    fprintf(stderr, " Write the CRC32C and xxh64 of every file the unpack writes to manifest\n");
+    fprintf(stderr, "Usage q2unpack --verify manifest [-nc] [--maps list] [--prune] path\n");
+    fprintf(stderr, " Check the files under path, or the unpack of it, against manifest\n");
+    fprintf(stderr, "Usage q2unpack --tar [-nc] [--maps list] [--prune] inpath\n");
+    fprintf(stderr, " Write the files as a tar stream to stdout\n");
+    fprintf(stderr, "Usage q2unpack --pk3 outfile [-nc] [--store-png] [--maps list] [--prune] inpath\n");
+    fprintf(stderr, " Write the files to a pk3, --store-png leaves the PNGs uncompressed\n");
+    fprintf(stderr, "Usage q2unpack --store storepath [-nc] [--maps list] [--prune] inpath outpath\n");
+    fprintf(stderr, " Keep each distinct file once in storepath and hard link outpath to them\n");
+    fprintf(stderr, "Usage q2unpack --serve port|unix:path [-nc] [--serve-cache mb] inpath\n");
+    fprintf(stderr, " Serve the files over HTTP on localhost, name.png converts name.pcx or name.wal\n");
+    fprintf(stderr, "Usage q2unpack --cat pakfile name\n");
+    fprintf(stderr, " Write a single file of a pak to stdout\n");
+    fprintf(stderr, "Usage q2unpack --list text|json inpath\n");
+    fprintf(stderr, " List the files with their pak, offset and length, S marks shadowed ones\n");
+    fprintf(stderr, "Usage q2unpack --stream-dir dirfile [--include p] [--exclude p] outpath < pakfile\n");
+    fprintf(stderr, " Copy the files of a pak from stdin as they go by, given its header and directory in dirfile\n");
+}
+
+int main(int argc, const char * argv[]) {
 
     int arg_index = 1;
     bool convert = true;
-    if (argc == 4)
-    {
-        if (strcmp(argv[1], "-nc") != 0) {
-            fprintf(stderr, "Usage q2unpack [-nc] inpath outpath\n");
-            fprintf(stderr, " -nc: Do not convert to imagess\n");
+    bool entities = false;
+    entityFormat_t entityFormat = ENTS_JSON;
+    int benchTraces = 0;
+    bool areas = false;
+    int hullContents = 0;
+    bool zbsp = false;
+    bool anims = false;
+    bool animSheets = false;
+    bool sounds = false;
+    int soundRate = 0;
+    bool soundNormalize = false;
+    soundFormat_t soundFormat = SOUND_WAV;
+    bool cinematics = false;
+    const char *mapList = NULL;
+    const char *pakPath = NULL;
+    const char *deltaOld = NULL;
+    const char *checksumPath = NULL;
+    bool verify = false;
+    bool tar = false;
+    const char *pk3Path = NULL;
+    bool storePng = false;
+    bool cat = false;
+    const char *listFormat = NULL;
+    std::vector<entryFilter_t> filters;
+    const char *streamDir = NULL;
+    const char *storePath = NULL;
+    const char *cachePath = NULL;
+    long cacheSize = CACHE_DEFAULT_SIZE;
+    bool watch = false;
+    const char *serveAddress = NULL;
+    long serveCache = SERVER_DEFAULT_CACHE;
+    bool prune = false;
+    bool listUnused = false;
+    int minimapSize = 0;
+    bool minimapLit = false;
+    for (; arg_index < argc && argv[arg_index][0] == '-' && argv[arg_index][1] != 0; arg_index++) {
+        if (strcmp(argv[arg_index], "-nc") == 0) {
+            convert = false;
+        } else if (strcmp(argv[arg_index], "--entities") == 0 && arg_index + 1 < argc) {
+            const char *fmt = argv[++arg_index];
+            entities = true;
+            if (strcmp(fmt, "json") == 0) {
+                entityFormat = ENTS_JSON;
+            } else if (strcmp(fmt, "bin") == 0) {
+                entityFormat = ENTS_BINARY;
+            } else {
+                usage();
+                return 1;
+            }
+        } else if (strcmp(argv[arg_index], "--areas") == 0) {
+            areas = true;
+        } else if (strcmp(argv[arg_index], "--hulls") == 0 && arg_index + 1 < argc) {
+            hullContents = parseContentsMask(argv[++arg_index]);
+            if (hullContents == 0) {
+                usage();
+                return 1;
+            }
+        } else if (strcmp(argv[arg_index], "--zbsp") == 0) {
+            zbsp = true;
+        } else if (strcmp(argv[arg_index], "--anims") == 0) {
+            anims = true;
+        } else if (strcmp(argv[arg_index], "--anim-sheets") == 0) {
+            anims = true;
+            animSheets = true;
+        } else if (strcmp(argv[arg_index], "--sound-rate") == 0 && arg_index + 1 < argc) {
+            sounds = true;
+            soundRate = atoi(argv[++arg_index]);
+            if (soundRate < 4000 || soundRate > 192000) {
+                usage();
+                return 1;
+            }
+        } else if (strcmp(argv[arg_index], "--sound-normalize") == 0) {
+            sounds = true;
+            soundNormalize = true;
+        } else if (strcmp(argv[arg_index], "--flac") == 0) {
+            sounds = true;
+            soundFormat = SOUND_FLAC;
+        } else if (strcmp(argv[arg_index], "--cin") == 0) {
+            cinematics = true;
+        } else if (strcmp(argv[arg_index], "--maps") == 0 && arg_index + 1 < argc) {
+            mapList = argv[++arg_index];
+        } else if (strcmp(argv[arg_index], "--pak") == 0 && arg_index + 1 < argc) {
+            pakPath = argv[++arg_index];
+        } else if (strcmp(argv[arg_index], "--delta") == 0 && arg_index + 2 < argc) {
+            deltaOld = argv[++arg_index];
+            pakPath = argv[++arg_index];
+        } else if (strcmp(argv[arg_index], "--checksum") == 0 && arg_index + 1 < argc) {
+            checksumPath = argv[++arg_index];
+        } else if (strcmp(argv[arg_index], "--verify") == 0 && arg_index + 1 < argc) {
+            checksumPath = argv[++arg_index];
+            verify = true;
+        } else if (strcmp(argv[arg_index], "--tar") == 0) {
+            tar = true;
+        } else if (strcmp(argv[arg_index], "--pk3") == 0 && arg_index + 1 < argc) {
+            pk3Path = argv[++arg_index];
+        } else if (strcmp(argv[arg_index], "--store-png") == 0) {
+            storePng = true;
+        } else if (strcmp(argv[arg_index], "--stream-dir") == 0 && arg_index + 1 < argc) {
+            streamDir = argv[++arg_index];
+        } else if (strcmp(argv[arg_index], "--store") == 0 && arg_index + 1 < argc) {
+            storePath = argv[++arg_index];
+        } else if (strcmp(argv[arg_index], "--cache") == 0 && arg_index + 1 < argc) {
+            cachePath = argv[++arg_index];
+        } else if (strcmp(argv[arg_index], "--cache-size") == 0 && arg_index + 1 < argc) {
+            cacheSize = atol(argv[++arg_index]);
+            if (cacheSize <= 0) {
+                usage();
+                return 1;
+            }
+        } else if (strcmp(argv[arg_index], "--watch") == 0) {
+            watch = true;
+        } else if (strcmp(argv[arg_index], "--serve") == 0 && arg_index + 1 < argc) {
+            serveAddress = argv[++arg_index];
+        } else if (strcmp(argv[arg_index], "--serve-cache") == 0 && arg_index + 1 < argc) {
+            serveCache = atol(argv[++arg_index]);
+            if (serveCache <= 0) {
+                usage();
+                return 1;
+            }
+        } else if (strcmp(argv[arg_index], "--cat") == 0) {
+            cat = true;
+        } else if (strcmp(argv[arg_index], "--list") == 0 && arg_index + 1 < argc) {
+            listFormat = argv[++arg_index];
+            if (strcmp(listFormat, "text") != 0 && strcmp(listFormat, "json") != 0) {
+                usage();
+                return 1;
+            }
+        } else if ((strcmp(argv[arg_index], "--include") == 0 || strcmp(argv[arg_index], "--exclude") == 0) &&
+                   arg_index + 1 < argc) {
+            bool exclude = strcmp(argv[arg_index], "--exclude") == 0;
+            if (!addFilter(filters, argv[++arg_index], exclude)) {
+                return 1;
+            }
+        } else if (strcmp(argv[arg_index], "--prune") == 0) {
+            prune = true;
+        } else if (strcmp(argv[arg_index], "--unused") == 0) {
+            listUnused = true;
+        } else if (strcmp(argv[arg_index], "--minimap") == 0 && arg_index + 1 < argc) {
+            minimapSize = atoi(argv[++arg_index]);
+            if (minimapSize <= 0 || minimapSize > 16384) {
+                usage();
+                return 1;
+            }
+        } else if (strcmp(argv[arg_index], "--minimap-lit") == 0) {
+            minimapLit = true;
+        } else if (strcmp(argv[arg_index], "--bench-trace") == 0 && arg_index + 1 < argc) {
+            benchTraces = atoi(argv[++arg_index]);
+            if (benchTraces <= 0) {
+                usage();
+                return 1;
+            }
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (cachePath != NULL && !openCache(cachePath, cacheSize * 1024 * 1024)) {
+        return 1;
+    }
+
+    if (cat) {
+        if (argc - arg_index != 2) {
+            usage();
+            return 1;
+        }
+        return catPakEntry(argv[arg_index], argv[arg_index + 1]) ? 0 : 1;
+    }
+
+    if (serveAddress != NULL) {
+        if (argc - arg_index != 1) {
+            usage();
+            return 1;
+        }
+        byte palette[768];
+        if (!readInput(argv[arg_index], filters, convert ? palette : NULL)) {
+            return 1;
+        }
+        lookupEntry(""); /* build the index before the workers use it */
+        bool r = serveFiles(serveAddress, serveCache * 1024 * 1024, [&](const std::string& path, std::vector<byte>& data) {
+            return resolveRequest(path, convert, data);
+        });
+        return r ? 0 : 1;
+    }
+
+    if (streamDir != NULL) {
+        if (argc - arg_index != 1) {
+            usage();
+            return 1;
+        }
+        mkdir(argv[arg_index], 0777);
+        return extractPakStream(0, streamDir, filters, argv[arg_index]) ? 0 : 1;
+    }
+
+    if (listFormat != NULL) {
+        if (argc - arg_index != 1) {
+            usage();
+            return 1;
+        }
+        FILE *out = takeStdout();
+        if (out == NULL || !readInput(argv[arg_index], filters, NULL)) {
+            return 1;
+        }
+        return listEntries(out, strcmp(listFormat, "json") == 0) ? 0 : 1;
+    }
+
+    if (benchTraces > 0 || listUnused) {
+        if (argc - arg_index != 1) {
+            usage();
+            return 1;
+        }
+        if (!readInput(argv[arg_index], filters, NULL)) {
+            return 1;
+        }
+        if (listUnused) {
+            return reportUnused() ? 0 : 1;
+        }
+        return benchmarkTraces(benchTraces) ? 0 : 1;
+    }
+
+    if (checksumPath != NULL) {
+        if (argc - arg_index != 1) {
+            usage();
+            return 1;
+        }
+        /* verify also takes an unpacked tree, which has no palette left to convert with */
+        byte palette[768];
+        bool hasPalette = convert;
+        std::vector<bool> selected;
+        if (!readInput(argv[arg_index], filters, convert ? palette : NULL, verify ? &hasPalette : NULL) ||
+            !selectEntries(mapList, prune, selected)) {
+            return 1;
+        }
+
+        /* the files as the unpack writes them */
+        bool converting = convert && hasPalette;
+        std::vector<int> files;
+        archiveFiles(converting, selected, files);
+        int first = converting ? 1 : 0;
+        checksumSource_t source = [&](int i, std::string& name, std::vector<byte>& data) {
+            if (i < first) {
+                name = "pics/colormap.bin";
+                data.assign(palette, palette + 768);
+                return true;
+            }
+            return unpackEntry(entries[files[i - first]], converting, name, data);
+        };
+        int count = int(files.size()) + first;
+        bool r = verify ? verifyChecksums(checksumPath, count, source) : writeChecksums(checksumPath, count, source);
+        reportCache();
+        return r ? 0 : 1;
+    }
+
+    if (tar) {
+        if (argc - arg_index != 1) {
+            usage();
+            return 1;
+        }
+        FILE *out = takeStdout();
+        if (out == NULL) {
+            return 1;
+        }
+        byte palette[768];
+        std::vector<bool> selected;
+        bool r = readInput(argv[arg_index], filters, convert ? palette : NULL) &&
+            selectEntries(mapList, prune, selected) && writeTar(out, convert, convert ? palette : NULL, selected);
+        fclose(out);
+        reportCache();
+        return r ? 0 : 1;
+    }
+
+    if (pk3Path != NULL) {
+        if (argc - arg_index != 1) {
+            usage();
+            return 1;
+        }
+        byte palette[768];
+        std::vector<bool> selected;
+        if (!readInput(argv[arg_index], filters, convert ? palette : NULL) ||
+            !selectEntries(mapList, prune, selected) ||
+            !writeArchivePk3(pk3Path, convert, convert ? palette : NULL, storePng, selected)) {
+            return 1;
+        }
+        reportCache();
+        return 0;
+    }
+
+    if (storePath != NULL) {
+        if (argc - arg_index != 2) {
+            usage();
             return 1;
         }
-        arg_index = 2;
-        convert = false;
+        byte palette[768];
+        std::vector<bool> selected;
+        mkdir(storePath, 0777);
+        mkdir(argv[arg_index + 1], 0777);
+        if (!readInput(argv[arg_index], filters, convert ? palette : NULL) ||
+            !selectEntries(mapList, prune, selected) ||
+            !writeStore(storePath, argv[arg_index + 1], convert, convert ? palette : NULL, selected)) {
+            return 1;
+        }
+        reportCache();
+        return 0;
+    }
+
+    if (pakPath != NULL) {
+        if (argc - arg_index != 1) {
+            usage();
+            return 1;
+        }
+        if (deltaOld != NULL) {
+            /* the old files are kept aside while the new ones are read */
+            if (!readInput(deltaOld, filters, NULL)) {
+                return 1;
+            }
+            std::vector<fileEntry> oldEntries;
+            oldEntries.swap(entries);
+            if (!readInput(argv[arg_index], filters, NULL) || !writeDelta(oldEntries, pakPath)) {
+                return 1;
+            }
+            return 0;
+        }
+        std::vector<bool> selected;
+        std::vector<int> order;
+        if (!readInput(argv[arg_index], filters, NULL) || !selectEntries(mapList, prune, selected) ||
+            !pakOrder(selected, order) || !writePak(pakPath, order)) {
+            return 1;
+        }
+        return 0;
+    }
+
+    if (argc - arg_index != 2) {
+        usage();
+        return 1;
+    }
+
+    if (watch && strcmp(argv[arg_index], "-") == 0) {
+        fprintf(stderr, "Cannot watch stdin\n");
+        return 1;
     }
 
     char path[1024];
@@ -651,29 +1680,60 @@ int main(int argc, const char * argv[]) {
     }
     mkdir(argv[arg_index + 1], 0777);
 
-    char picspath[1024];
-    sprintf(picspath,"%spics", path);
-
-    if (!readDir(argv[arg_index], "")) {
+    byte palette[768];
+    bool needPalette = convert || minimapSize > 0 || animSheets;
+    if (!readInput(argv[arg_index], filters, needPalette ? palette : NULL)) {
         return 1;
     }
 
     printf("Files: %lu\n", entries.size());
-    if (convert && !loadPalette("pics/colormap.pcx", picspath, "colormap.bin")) {
+    if (needPalette && !writePalette(palette, path, "pics/colormap.bin")) {
         return 1;
     }
 
+    std::vector<bool> selected;
+    if (!selectEntries(mapList, prune, selected)) {
+        return 1;
+    }
+
+    /* copy throughput, to compare the sound conversion against */
+    long copyBytes = 0;
+    double copySeconds = 0;
+    auto copy = [&](const fileEntry& entry) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool r = copyFile(entry, path);
+        copySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        copyBytes += entry.length;
+        return r;
+    };
+
     for (const fileEntry& entry : entries) {
+        int index = int(&entry - entries.data());
+        if (!selected[index]) {
+            continue;
+        }
+        if (lookupEntry(entry.name) != index) {
+            continue; // Shadowed by a copy that comes first in the search order
+        }
+        if (zbsp && strncmp(entry.name, "maps/", 5) == 0 && hasExtension(entry.name, ".bsp")) {
+            continue; // Written as .bspz below
+        }
+        if (sounds && strncmp(entry.name, "sound/", 6) == 0 && hasExtension(entry.name, ".wav")) {
+            continue; // Converted below
+        }
+        if (cinematics && strncmp(entry.name, "video/", 6) == 0 && hasExtension(entry.name, ".cin")) {
+            continue; // Decoded below
+        }
         int len = int(strlen(entry.name));
         if (convert) {
             if (strcmp(entry.name, "pics/colormap.pcx") == 0) { // We already handled this one
             } else if (len > 4 && strcmp(&entry.name[len - 4], ".pcx") == 0) {
                 bool isSkin = strncmp(entry.name, "models", 6) == 0 || strncmp(entry.name, "players", 7) == 0;
-                if (!convertPcx(entry, path, isSkin)) {
+                if (!convertImage(entry, path, isSkin)) {
                     return 1;
                 }
             } else if (len > 4 && strcmp(&entry.name[len - 4], ".wal") == 0) {
-                if (!convertWal(entry, path)) {
+                if (!convertImage(entry, path, false)) {
                     return 1;
                 }
             } else if (len > 4 && strcmp(&entry.name[len - 4], ".tga") == 0) {
@@ -681,17 +1741,84 @@ int main(int argc, const char * argv[]) {
                 printf("TGA %s\n", entry.name);
             } else {
                 // Just copy the rest of the files
-                if (!copyFile(entry, path)) {
+                if (!copy(entry)) {
                     return 1;
                 }
             }
         } else {
-            if (!copyFile(entry, path)) {
+            if (!copy(entry)) {
                 return 1;
             }
         }
     }
 
+    reportCache();
+
+    if (entities && !exportEntities(path, entityFormat, selected)) {
+        return 1;
+    }
+
+    if (areas && !exportAreas(path, selected)) {
+        return 1;
+    }
+
+    if (zbsp && !exportCompressedMaps(path, selected)) {
+        return 1;
+    }
+
+    if (sounds) {
+        printf("Copied: %ld bytes in %.3f s (%.1f MB/s)\n", copyBytes, copySeconds,
+               copySeconds > 0 ? copyBytes / copySeconds / (1024 * 1024) : 0.0);
+        if (!convertSounds(path, selected, soundRate, soundNormalize, soundFormat)) {
+            return 1;
+        }
+    }
+
+    if (cinematics && !decodeCinematics(path, selected)) {
+        return 1;
+    }
+
+    if (hullContents != 0 && !exportHulls(path, hullContents, selected)) {
+        return 1;
+    }
+
+    if (anims && !exportAnimations(path, animSheets, selected)) {
+        return 1;
+    }
+
+    if (minimapSize > 0 && !renderMinimaps(path, minimapSize, minimapLit, selected)) {
+        return 1;
+    }
+
+    if (watch) {
+        unpackOptions_t opts;
+        opts.inPath = argv[arg_index];
+        opts.outPath = path;
+        opts.convert = convert;
+        opts.filters = &filters;
+        opts.mapList = mapList;
+        opts.prune = prune;
+        opts.sounds = sounds;
+        opts.soundRate = soundRate;
+        opts.soundNormalize = soundNormalize;
+        opts.soundFormat = soundFormat;
+        opts.cinematics = cinematics;
+        opts.zbsp = zbsp;
+        opts.entities = entities;
+        opts.entityFormat = entityFormat;
+        opts.areas = areas;
+        opts.hullContents = hullContents;
+        opts.anims = anims;
+        opts.animSheets = animSheets;
+        opts.minimapSize = minimapSize;
+        opts.minimapLit = minimapLit;
+        if (!watchTree(opts.inPath, WATCH_DEBOUNCE_MS, [&](const std::vector<watchChange_t>& changes) {
+            return applyChanges(opts, changes);
+        })) {
+            return 1;
+        }
+    }
+
     entries.clear();
     return 0;
 }
@@ -0,0 +1,414 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <cfloat>
+#include <string>
+#include <map>
+#include "bsp.h"
+#include "minimap.h"
+
+#define TILE_SIZE 64
+
+typedef struct
+{
+    int width, height;
+    uint32_t *pixels; /* NULL if the texture is missing */
+} mapTexture_t;
+
+typedef struct
+{
+    int smin[2];   /* lightmap origin in 16 unit texels */
+    int extents[2];
+    const byte *samples; /* NULL if not lit */
+} faceLight_t;
+
+typedef struct
+{
+    float x[3], y[3];  /* image coordinates */
+    float pos[3][3];   /* world coordinates */
+    int texinfo;
+    int face;
+} mapTriangle_t;
+
+typedef struct
+{
+    int size;
+    bool lightmapped;
+    float minz, maxz;
+    const texinfo_t *texinfo;
+    std::vector<const mapTexture_t *> textures; /* indexed by texinfo */
+    std::vector<faceLight_t> lights;            /* indexed by face */
+    std::vector<mapTriangle_t> tris;
+    std::vector<std::vector<int> > bins;        /* triangles touching each tile */
+    uint32_t *color;
+    float *depth;
+} minimap_t;
+
+static float texCoord(const texinfo_t *ti, int axis, const float p[3])
+{
+    return p[0] * ti->vecs[axis][0] + p[1] * ti->vecs[axis][1] + p[2] * ti->vecs[axis][2] + ti->vecs[axis][3];
+}
+
+/*
+ * Compute the lightmap extents of a face like the renderer does.
+ */
+static void faceExtents(const float *verts, int numverts, const texinfo_t *ti, faceLight_t *light)
+{
+    float mins[2] = {FLT_MAX, FLT_MAX};
+    float maxs[2] = {-FLT_MAX, -FLT_MAX};
+    for (int i = 0; i < numverts; i++) {
+        for (int j = 0; j < 2; j++) {
+            float v = texCoord(ti, j, &verts[i * 3]);
+            if (v < mins[j]) {
+                mins[j] = v;
+            }
+            if (v > maxs[j]) {
+                maxs[j] = v;
+            }
+        }
+    }
+    for (int j = 0; j < 2; j++) {
+        int bmin = int(floorf(mins[j] / 16));
+        int bmax = int(ceilf(maxs[j] / 16));
+        light->smin[j] = bmin;
+        light->extents[j] = bmax - bmin;
+    }
+}
+
+static void sampleLight(const faceLight_t *light, float s, float t, float rgb[3])
+{
+    int w = light->extents[0] + 1;
+    int h = light->extents[1] + 1;
+    float fs = s / 16 - light->smin[0];
+    float ft = t / 16 - light->smin[1];
+    if (fs < 0) {
+        fs = 0;
+    }
+    if (ft < 0) {
+        ft = 0;
+    }
+    if (fs > w - 1) {
+        fs = float(w - 1);
+    }
+    if (ft > h - 1) {
+        ft = float(h - 1);
+    }
+
+    /* bilinear between the four nearest samples */
+    int s0 = int(fs), t0 = int(ft);
+    int s1 = s0 + 1 < w ? s0 + 1 : s0;
+    int t1 = t0 + 1 < h ? t0 + 1 : t0;
+    float a = fs - s0, b = ft - t0;
+    for (int c = 0; c < 3; c++) {
+        float v00 = light->samples[(t0 * w + s0) * 3 + c];
+        float v10 = light->samples[(t0 * w + s1) * 3 + c];
+        float v01 = light->samples[(t1 * w + s0) * 3 + c];
+        float v11 = light->samples[(t1 * w + s1) * 3 + c];
+        rgb[c] = (v00 * (1 - a) + v10 * a) * (1 - b) + (v01 * (1 - a) + v11 * a) * b;
+    }
+}
+
+static uint32_t shadePixel(const minimap_t *mm, const mapTriangle_t *tri, const float p[3])
+{
+    const texinfo_t *ti = &mm->texinfo[tri->texinfo];
+    const mapTexture_t *tex = mm->textures[tri->texinfo];
+    float s = texCoord(ti, 0, p);
+    float t = texCoord(ti, 1, p);
+
+    uint32_t texel = 0xff808080;
+    if (tex->pixels != NULL) {
+        int x = int(floorf(s)) % tex->width;
+        int y = int(floorf(t)) % tex->height;
+        if (x < 0) {
+            x += tex->width;
+        }
+        if (y < 0) {
+            y += tex->height;
+        }
+        texel = tex->pixels[y * tex->width + x];
+    }
+
+    float scale[3];
+    float h = mm->maxz > mm->minz ? (p[2] - mm->minz) / (mm->maxz - mm->minz) : 1;
+    scale[0] = scale[1] = scale[2] = 0.5f + 0.5f * h;
+
+    const faceLight_t *light = &mm->lights[tri->face];
+    if (mm->lightmapped && light->samples != NULL) {
+        float rgb[3];
+        sampleLight(light, s, t, rgb);
+        for (int c = 0; c < 3; c++) {
+            scale[c] *= rgb[c] / 128.0f;
+        }
+    }
+
+    uint32_t out = 0xff000000;
+    for (int c = 0; c < 3; c++) {
+        float v = ((texel >> (c * 8)) & 0xff) * scale[c];
+        out |= uint32_t(v > 255 ? 255 : v) << (c * 8);
+    }
+    return out;
+}
+
+static void renderTile(const minimap_t *mm, int tile)
+{
+    int tilesPerRow = (mm->size + TILE_SIZE - 1) / TILE_SIZE;
+    int tx0 = (tile % tilesPerRow) * TILE_SIZE;
+    int ty0 = (tile / tilesPerRow) * TILE_SIZE;
+    int tx1 = tx0 + TILE_SIZE < mm->size ? tx0 + TILE_SIZE : mm->size;
+    int ty1 = ty0 + TILE_SIZE < mm->size ? ty0 + TILE_SIZE : mm->size;
+
+    for (int index : mm->bins[tile]) {
+        const mapTriangle_t *tri = &mm->tris[index];
+        float area = (tri->x[1] - tri->x[0]) * (tri->y[2] - tri->y[0]) -
+                     (tri->x[2] - tri->x[0]) * (tri->y[1] - tri->y[0]);
+        if (fabsf(area) < 1e-6f) {
+            continue;
+        }
+        float iarea = 1.0f / area;
+
+        float fminx = fminf(tri->x[0], fminf(tri->x[1], tri->x[2]));
+        float fmaxx = fmaxf(tri->x[0], fmaxf(tri->x[1], tri->x[2]));
+        float fminy = fminf(tri->y[0], fminf(tri->y[1], tri->y[2]));
+        float fmaxy = fmaxf(tri->y[0], fmaxf(tri->y[1], tri->y[2]));
+        int minx = int(floorf(fminx)) > tx0 ? int(floorf(fminx)) : tx0;
+        int maxx = int(ceilf(fmaxx)) < tx1 ? int(ceilf(fmaxx)) : tx1;
+        int miny = int(floorf(fminy)) > ty0 ? int(floorf(fminy)) : ty0;
+        int maxy = int(ceilf(fmaxy)) < ty1 ? int(ceilf(fmaxy)) : ty1;
+
+        for (int y = miny; y < maxy; y++) {
+            float py = y + 0.5f;
+            for (int x = minx; x < maxx; x++) {
+                float px = x + 0.5f;
+
+                /* barycentric weights of the pixel center */
+                float w0 = ((tri->x[1] - px) * (tri->y[2] - py) - (tri->x[2] - px) * (tri->y[1] - py)) * iarea;
+                float w1 = ((tri->x[2] - px) * (tri->y[0] - py) - (tri->x[0] - px) * (tri->y[2] - py)) * iarea;
+                float w2 = 1 - w0 - w1;
+                if (w0 < 0 || w1 < 0 || w2 < 0) {
+                    continue;
+                }
+
+                float p[3];
+                for (int i = 0; i < 3; i++) {
+                    p[i] = tri->pos[0][i] * w0 + tri->pos[1][i] * w1 + tri->pos[2][i] * w2;
+                }
+
+                /* the highest surface is seen from above */
+                int pixel = y * mm->size + x;
+                if (p[2] <= mm->depth[pixel]) {
+                    continue;
+                }
+                mm->depth[pixel] = p[2];
+                mm->color[pixel] = shadePixel(mm, tri, p);
+            }
+        }
+    }
+}
+
+static bool renderMinimap(const fileEntry& entry, const char *outPath, int size, bool lightmapped)
+{
+    bspFile_t bsp;
+    if (!openBsp(entry, &bsp)) {
+        return false;
+    }
+
+    int numverts, numedges, numsurfedges, numfaces, numtexinfo, numplanes, nummodels, lightlen;
+    dvertex_t *verts = (dvertex_t *)loadBspLump(&bsp, LUMP_VERTEXES, sizeof(dvertex_t), &numverts);
+    dedge_t *edges = (dedge_t *)loadBspLump(&bsp, LUMP_EDGES, sizeof(dedge_t), &numedges);
+    int *surfedges = (int *)loadBspLump(&bsp, LUMP_SURFEDGES, sizeof(int), &numsurfedges);
+    dface_t *faces = (dface_t *)loadBspLump(&bsp, LUMP_FACES, sizeof(dface_t), &numfaces);
+    texinfo_t *texinfo = (texinfo_t *)loadBspLump(&bsp, LUMP_TEXINFO, sizeof(texinfo_t), &numtexinfo);
+    dplane_t *planes = (dplane_t *)loadBspLump(&bsp, LUMP_PLANES, sizeof(dplane_t), &numplanes);
+    dmodel_t *models = (dmodel_t *)loadBspLump(&bsp, LUMP_MODELS, sizeof(dmodel_t), &nummodels);
+    byte *lighting = (byte *)loadBspLump(&bsp, LUMP_LIGHTING, 1, &lightlen);
+
+    bool r = verts && edges && surfedges && faces && texinfo && planes && models && lighting;
+    if (r && nummodels < 1) {
+        fprintf(stderr, "Map %s has no models\n", entry.name);
+        r = false;
+    }
+
+    minimap_t mm;
+    std::map<std::string, mapTexture_t> textures;
+    if (r) {
+        mm.size = size;
+        mm.lightmapped = lightmapped;
+        mm.texinfo = texinfo;
+        mm.minz = models[0].mins[2];
+        mm.maxz = models[0].maxs[2];
+
+        /* textures shared by texinfos are decoded once */
+        mm.textures.resize(numtexinfo);
+        for (int i = 0; i < numtexinfo; i++) {
+            std::string name(texinfo[i].texture, strnlen(texinfo[i].texture, sizeof(texinfo[i].texture)));
+            std::map<std::string, mapTexture_t>::iterator it = textures.find(name);
+            if (it == textures.end()) {
+                mapTexture_t tex = {0, 0, NULL};
+                fileEntry *wal = findEntry(("textures/" + name + ".wal").c_str());
+                if (wal != NULL) {
+                    tex.pixels = loadWal(*wal, &tex.width, &tex.height);
+                }
+                it = textures.insert(std::make_pair(name, tex)).first;
+            }
+            mm.textures[i] = &it->second;
+        }
+
+        /* world model faces are mapped to the image, x right and y up */
+        float extent = models[0].maxs[0] - models[0].mins[0];
+        if (models[0].maxs[1] - models[0].mins[1] > extent) {
+            extent = models[0].maxs[1] - models[0].mins[1];
+        }
+        float scale = extent > 0 ? size / extent : 1;
+        float cx = (models[0].mins[0] + models[0].maxs[0]) * 0.5f;
+        float cy = (models[0].mins[1] + models[0].maxs[1]) * 0.5f;
+
+        mm.lights.resize(numfaces);
+        int lastface = models[0].firstface + models[0].numfaces;
+        for (int f = models[0].firstface; f < lastface && f < numfaces && r; f++) {
+            const dface_t *face = &faces[f];
+            faceLight_t *light = &mm.lights[f];
+            light->samples = NULL;
+
+            if (face->texinfo < 0 || face->texinfo >= numtexinfo || face->planenum >= numplanes ||
+                face->firstedge < 0 || face->numedges < 3 || face->firstedge + face->numedges > numsurfedges) {
+                fprintf(stderr, "Bad face %d in %s\n", f, entry.name);
+                r = false;
+                break;
+            }
+            const texinfo_t *ti = &texinfo[face->texinfo];
+            if (ti->flags & (SURF_SKY | SURF_NODRAW)) {
+                continue;
+            }
+            float nz = planes[face->planenum].normal[2];
+            if (face->side) {
+                nz = -nz;
+            }
+            if (nz <= 0.01f) {
+                continue; /* walls and ceilings are not seen from above */
+            }
+
+            std::vector<float> poly(face->numedges * 3);
+            for (int i = 0; i < face->numedges && r; i++) {
+                int e = surfedges[face->firstedge + i];
+                int v = -1;
+                if (e >= 0 && e < numedges) {
+                    v = edges[e].v[0];
+                } else if (e < 0 && -e < numedges) {
+                    v = edges[-e].v[1];
+                }
+                if (v < 0 || v >= numverts) {
+                    fprintf(stderr, "Bad edge in face %d of %s\n", f, entry.name);
+                    r = false;
+                    break;
+                }
+                memcpy(&poly[i * 3], verts[v].point, sizeof(verts[v].point));
+            }
+            if (!r) {
+                break;
+            }
+
+            faceExtents(poly.data(), face->numedges, ti, light);
+            int lsize = (light->extents[0] + 1) * (light->extents[1] + 1) * 3;
+            if (face->styles[0] != 255 && face->lightofs >= 0 && face->lightofs + lsize <= lightlen) {
+                light->samples = lighting + face->lightofs;
+            }
+
+            for (int i = 2; i < face->numedges; i++) {
+                mapTriangle_t tri;
+                const float *corner[3] = {&poly[0], &poly[(i - 1) * 3], &poly[i * 3]};
+                for (int j = 0; j < 3; j++) {
+                    memcpy(tri.pos[j], corner[j], sizeof(tri.pos[j]));
+                    tri.x[j] = (corner[j][0] - cx) * scale + size * 0.5f;
+                    tri.y[j] = (cy - corner[j][1]) * scale + size * 0.5f;
+                }
+                tri.texinfo = face->texinfo;
+                tri.face = f;
+                mm.tris.push_back(tri);
+            }
+        }
+    }
+
+    if (r) {
+        int tilesPerRow = (size + TILE_SIZE - 1) / TILE_SIZE;
+        mm.bins.resize(tilesPerRow * tilesPerRow);
+        for (size_t i = 0; i < mm.tris.size(); i++) {
+            const mapTriangle_t *tri = &mm.tris[i];
+            float minx = fminf(tri->x[0], fminf(tri->x[1], tri->x[2]));
+            float maxx = fmaxf(tri->x[0], fmaxf(tri->x[1], tri->x[2]));
+            float miny = fminf(tri->y[0], fminf(tri->y[1], tri->y[2]));
+            float maxy = fmaxf(tri->y[0], fmaxf(tri->y[1], tri->y[2]));
+            int x0 = int(minx) / TILE_SIZE, x1 = int(maxx) / TILE_SIZE;
+            int y0 = int(miny) / TILE_SIZE, y1 = int(maxy) / TILE_SIZE;
+            for (int y = y0 < 0 ? 0 : y0; y <= y1 && y < tilesPerRow; y++) {
+                for (int x = x0 < 0 ? 0 : x0; x <= x1 && x < tilesPerRow; x++) {
+                    mm.bins[y * tilesPerRow + x].push_back(int(i));
+                }
+            }
+        }
+
+        mm.color = (uint32_t *)malloc(size_t(size) * size * 4);
+        mm.depth = (float *)malloc(size_t(size) * size * sizeof(float));
+        for (int i = 0; i < size * size; i++) {
+            mm.color[i] = 0; /* transparent where nothing is seen */
+            mm.depth[i] = -FLT_MAX;
+        }
+
+        parallelFor(int(mm.bins.size()), [&](int tile) {
+            renderTile(&mm, tile);
+            return true;
+        });
+
+        char fullpath[1024];
+        r = createOutputPath(outPath, entry.name, ".minimap.png", fullpath, sizeof(fullpath)) &&
+            writePng(fullpath, size, size, mm.color);
+        free(mm.color);
+        free(mm.depth);
+    }
+
+    for (std::map<std::string, mapTexture_t>::iterator it = textures.begin(); it != textures.end(); ++it) {
+        free(it->second.pixels);
+    }
+    free(verts);
+    free(edges);
+    free(surfedges);
+    free(faces);
+    free(texinfo);
+    free(planes);
+    free(models);
+    free(lighting);
+    return r;
+}
+
+bool renderMinimaps(const char *outPath, int size, bool lightmapped, const std::vector<bool>& selected)
+{
+    std::vector<const fileEntry *> maps;
+    findSelectedMaps(selected, maps);
+
+    for (const fileEntry *entry : maps) {
+        if (!renderMinimap(*entry, outPath, size, lightmapped)) {
+            return false;
+        }
+    }
+    printf("Minimaps: %lu maps\n", maps.size());
+    return true;
+}
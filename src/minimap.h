@@ -0,0 +1,41 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Top-down overview images of maps
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_MINIMAP_H
+#define Q2UNPACK_MINIMAP_H
+
+#include "common.h"
+
+/*
+ * Render the upward facing faces of every selected map from above to a
+ * size x size PNG next to the extracted BSP. Faces are textured with
+ * d_8to24table, so the palette must be loaded, shaded by height and
+ * optionally by their lightmaps. Tiles of the image are rendered in
+ * parallel.
+ */
+bool renderMinimaps(const char *outPath, int size, bool lightmapped, const std::vector<bool>& selected);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include "bsp.h"
+#include "depends.h"
+#include "pak.h"
+
+/* Size of the copy buffer and the output buffer */
+#define PAK_BUFFER_SIZE 0x100000
+
+static bool nameLess(int a, int b)
+{
+    return strcmp(entries[a].name, entries[b].name) < 0;
+}
+
+bool pakOrder(const std::vector<bool>& selected, std::vector<int>& order)
+{
+    std::vector<bool> placed(entries.size(), false);
+    order.clear();
+
+    /* maps by name, each followed by its references breadth first so
+       the files loaded together are next to each other */
+    std::vector<const fileEntry *> maps;
+    findMaps(maps);
+    std::vector<int> roots;
+    for (const fileEntry *map : maps) {
+        roots.push_back(int(map - entries.data()));
+    }
+    std::sort(roots.begin(), roots.end(), nameLess);
+
+    for (int root : roots) {
+        if (!selected[root] || placed[root]) {
+            continue;
+        }
+        size_t head = order.size();
+        order.push_back(root);
+        placed[root] = true;
+        while (head < order.size()) {
+            std::vector<std::string> deps;
+            if (!entryDependencies(entries[order[head++]], deps)) {
+                return false;
+            }
+            for (const std::string& dep : deps) {
+                int i = lookupEntry(dep.c_str());
+                if (i >= 0 && selected[i] && !placed[i]) {
+                    order.push_back(i);
+                    placed[i] = true;
+                }
+            }
+        }
+    }
+
+    std::vector<int> rest;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (selected[i] && !placed[i] && findEntry(entries[i].name) == &entries[i]) {
+            rest.push_back(int(i));
+        }
+    }
+    std::sort(rest.begin(), rest.end(), nameLess);
+    order.insert(order.end(), rest.begin(), rest.end());
+    return true;
+}
+
+bool writePak(const char *path, const std::vector<int>& order)
+{
+    if (order.empty() || order.size() > MAX_FILES_IN_PACK) {
+        fprintf(stderr, "Cannot write %lu files to %s\n", order.size(), path);
+        return false;
+    }
+
+    /* lay out the data first, the directory goes after it */
+    std::vector<dpackfile_t> dir(order.size());
+    long pos = sizeof(dpackheader_t);
+    for (size_t i = 0; i < order.size(); i++) {
+        const fileEntry& entry = entries[order[i]];
+        if (strlen(entry.name) >= sizeof(dir[i].name)) {
+            fprintf(stderr, "Name too long for a pak: %s\n", entry.name);
+            return false;
+        }
+        if (entry.length >= PAK_ALIGN_SIZE) {
+            pos = (pos + PAK_PAGE_SIZE - 1) & ~long(PAK_PAGE_SIZE - 1);
+        }
+        memset(dir[i].name, 0, sizeof(dir[i].name));
+        strcpy(dir[i].name, entry.name);
+        dir[i].filepos = LittleLong(int(pos));
+        dir[i].filelen = LittleLong(int(entry.length));
+        pos += entry.length;
+        if (pos > 0x7fffffff - long(dir.size() * sizeof(dpackfile_t))) {
+            fprintf(stderr, "Too much data for %s\n", path);
+            return false;
+        }
+    }
+
+    dpackheader_t header;
+    header.ident = LittleLong(IDPAKHEADER);
+    header.dirofs = LittleLong(int(pos));
+    header.dirlen = LittleLong(int(dir.size() * sizeof(dpackfile_t)));
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return false;
+    }
+    std::vector<char> outbuf(PAK_BUFFER_SIZE);
+    setvbuf(f, outbuf.data(), _IOFBF, outbuf.size());
+
+    std::vector<byte> buffer(PAK_BUFFER_SIZE);
+    bool r = fwrite(&header, sizeof(header), 1, f) == 1;
+    pos = sizeof(header);
+    for (size_t i = 0; i < order.size() && r; i++) {
+        const fileEntry& entry = entries[order[i]];
+        long filepos = LittleLong(dir[i].filepos);
+        memset(buffer.data(), 0, PAK_PAGE_SIZE);
+        r = fwrite(buffer.data(), 1, filepos - pos, f) == size_t(filepos - pos);
+        for (long ofs = 0; ofs < entry.length && r; ofs += PAK_BUFFER_SIZE) {
+            long len = std::min(entry.length - ofs, long(PAK_BUFFER_SIZE));
+            r = readEntry(entry, ofs, buffer.data(), len) &&
+                fwrite(buffer.data(), 1, len, f) == size_t(len);
+        }
+        pos = filepos + entry.length;
+    }
+    r = r && fwrite(dir.data(), sizeof(dpackfile_t), dir.size(), f) == dir.size();
+
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return false;
+    }
+    printf("Wrote %s: %lu files, %ld bytes\n", path, order.size(), pos + long(dir.size() * sizeof(dpackfile_t)));
+    return true;
+}
@@ -0,0 +1,50 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  PAK writing
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_PAK_H
+#define Q2UNPACK_PAK_H
+
+#include "common.h"
+
+/* Entries at least this big start at a page boundary so they can be
+ * mapped straight from the pak */
+#define PAK_ALIGN_SIZE 0x10000
+#define PAK_PAGE_SIZE 0x1000
+
+/*
+ * Order the resolved, selected entries the way a game loads them:
+ * each map followed by what it refers to, then the rest by name.
+ * The result holds indexes to entries.
+ */
+bool pakOrder(const std::vector<bool>& selected, std::vector<int>& order);
+
+/*
+ * Write the given entries, in order, to a new pak file. The data comes
+ * first and the directory is written in one go at the end.
+ */
+bool writePak(const char *path, const std::vector<int>& order);
+
+#endif
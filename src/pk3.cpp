@@ -0,0 +1,178 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <zlib.h>
+#include "pk3.h"
+
+#define PK3_LOCAL_SIGNATURE 0x04034b50
+#define PK3_CENTRAL_SIGNATURE 0x02014b50
+#define PK3_END_SIGNATURE 0x06054b50
+#define PK3_STORED 0
+#define PK3_DEFLATED 8
+#define PK3_VERSION 20
+#define PK3_DOS_DATE 0x21 /* 1980-01-01, for reproducible archives */
+
+/* Size of the output buffer */
+#define PK3_BUFFER_SIZE 0x100000
+
+static void put16(std::vector<byte>& out, uint32_t v)
+{
+    out.push_back(byte(v));
+    out.push_back(byte(v >> 8));
+}
+
+static void put32(std::vector<byte>& out, uint32_t v)
+{
+    put16(out, v & 0xffff);
+    put16(out, v >> 16);
+}
+
+bool compressPk3File(pk3File_t& file, std::vector<byte>& data, bool store)
+{
+    if (data.size() > 0xffffffffUL) {
+        fprintf(stderr, "File too large for a pk3: %s\n", file.name.c_str());
+        return false;
+    }
+    file.size = uint32_t(data.size());
+    file.csize = file.size;
+    file.method = PK3_STORED;
+    file.crc = uint32_t(crc32(crc32(0, Z_NULL, 0), data.data(), uInt(data.size())));
+    if (store || data.empty()) {
+        return true;
+    }
+
+    /* raw deflate, zip has its own headers */
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "Failed to compress %s\n", file.name.c_str());
+        return false;
+    }
+    std::vector<byte> packed(deflateBound(&z, uLong(data.size())));
+    z.next_in = data.data();
+    z.avail_in = uInt(data.size());
+    z.next_out = packed.data();
+    z.avail_out = uInt(packed.size());
+    int r = deflate(&z, Z_FINISH);
+    deflateEnd(&z);
+    if (r != Z_STREAM_END) {
+        fprintf(stderr, "Failed to compress %s\n", file.name.c_str());
+        return false;
+    }
+
+    if (z.total_out < data.size()) {
+        packed.resize(z.total_out);
+        data.swap(packed);
+        file.csize = uint32_t(data.size());
+        file.method = PK3_DEFLATED;
+    }
+    return true;
+}
+
+bool openPk3(pk3_t& pk3, const char *path)
+{
+    pk3.file = fopen(path, "wb");
+    if (!pk3.file) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return false;
+    }
+    setvbuf(pk3.file, NULL, _IOFBF, PK3_BUFFER_SIZE);
+    pk3.offset = 0;
+    pk3.files.clear();
+    return true;
+}
+
+bool writePk3File(pk3_t& pk3, pk3File_t& file, const std::vector<byte>& data)
+{
+    if (pk3.files.size() >= PK3_MAX_FILES || file.name.size() > 0xffff ||
+        pk3.offset + 30 + long(file.name.size()) + long(data.size()) > 0xffffffffL) {
+        fprintf(stderr, "Too much data for a pk3 at %s\n", file.name.c_str());
+        return false;
+    }
+    file.offset = uint32_t(pk3.offset);
+
+    std::vector<byte> header;
+    put32(header, PK3_LOCAL_SIGNATURE);
+    put16(header, PK3_VERSION);
+    put16(header, 0); /* flags */
+    put16(header, file.method);
+    put16(header, 0); /* time */
+    put16(header, PK3_DOS_DATE);
+    put32(header, file.crc);
+    put32(header, file.csize);
+    put32(header, file.size);
+    put16(header, uint32_t(file.name.size()));
+    put16(header, 0); /* extra */
+    header.insert(header.end(), file.name.begin(), file.name.end());
+
+    if (fwrite(header.data(), 1, header.size(), pk3.file) != header.size() ||
+        fwrite(data.data(), 1, data.size(), pk3.file) != data.size()) {
+        fprintf(stderr, "Failed to write %s to pk3\n", file.name.c_str());
+        return false;
+    }
+    pk3.offset += long(header.size() + data.size());
+    pk3.files.push_back(file);
+    return true;
+}
+
+bool closePk3(pk3_t& pk3)
+{
+    std::vector<byte> dir;
+    for (const pk3File_t& file : pk3.files) {
+        put32(dir, PK3_CENTRAL_SIGNATURE);
+        put16(dir, (3 << 8) | PK3_VERSION); /* made on unix */
+        put16(dir, PK3_VERSION);
+        put16(dir, 0); /* flags */
+        put16(dir, file.method);
+        put16(dir, 0); /* time */
+        put16(dir, PK3_DOS_DATE);
+        put32(dir, file.crc);
+        put32(dir, file.csize);
+        put32(dir, file.size);
+        put16(dir, uint32_t(file.name.size()));
+        put16(dir, 0); /* extra */
+        put16(dir, 0); /* comment */
+        put16(dir, 0); /* disk */
+        put16(dir, 0); /* internal attributes */
+        put32(dir, 0100644u << 16); /* regular file, rw-r--r-- */
+        put32(dir, file.offset);
+        dir.insert(dir.end(), file.name.begin(), file.name.end());
+    }
+
+    uint32_t dirSize = uint32_t(dir.size());
+    put32(dir, PK3_END_SIGNATURE);
+    put16(dir, 0); /* disk */
+    put16(dir, 0); /* disk of the directory */
+    put16(dir, uint32_t(pk3.files.size()));
+    put16(dir, uint32_t(pk3.files.size()));
+    put32(dir, dirSize);
+    put32(dir, uint32_t(pk3.offset));
+    put16(dir, 0); /* comment */
+
+    bool r = pk3.offset + long(dir.size()) <= 0xffffffffL &&
+        fwrite(dir.data(), 1, dir.size(), pk3.file) == dir.size();
+    if (fclose(pk3.file) != 0 || !r) {
+        fprintf(stderr, "Failed to write pk3 directory\n");
+        return false;
+    }
+    pk3.file = NULL;
+    return true;
+}
@@ -0,0 +1,75 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  PK3 (zip) output
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_PK3_H
+#define Q2UNPACK_PK3_H
+
+#include <string>
+#include "common.h"
+
+#define PK3_MAX_FILES 0xffff
+
+typedef struct
+{
+    std::string name;
+    uint32_t crc;
+    uint32_t size;
+    uint32_t csize;
+    uint16_t method;
+    uint32_t offset;
+} pk3File_t;
+
+typedef struct
+{
+    FILE *file;
+    long offset;
+    std::vector<pk3File_t> files;
+} pk3_t;
+
+/*
+ * Checksum and, unless store is set, deflate a file in place. The data
+ * is kept stored when deflating does not make it smaller. Safe to run
+ * on several files at once.
+ */
+bool compressPk3File(pk3File_t& file, std::vector<byte>& data, bool store);
+
+/*
+ * Create the archive.
+ */
+bool openPk3(pk3_t& pk3, const char *path);
+
+/*
+ * Append a file compressed by compressPk3File. Files are written one
+ * at a time, in the order they are added.
+ */
+bool writePk3File(pk3_t& pk3, pk3File_t& file, const std::vector<byte>& data);
+
+/*
+ * Write the central directory and close the archive.
+ */
+bool closePk3(pk3_t& pk3);
+
+#endif
@@ -0,0 +1,420 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <unordered_map>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "server.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define SERVER_MAX_REQUEST 8192
+#define SERVER_TIMEOUT 5 /* seconds a client may take to send the request or to read */
+#define SERVER_BUCKETS 32 /* latency histogram, bucket n is under 2^n microseconds */
+
+typedef std::shared_ptr<const std::vector<byte> > blob_t;
+
+typedef struct
+{
+    std::mutex lock;
+    long maxBytes;
+    long bytes;
+    std::list<std::pair<std::string, blob_t> > order; /* most recent first */
+    std::unordered_map<std::string, std::list<std::pair<std::string, blob_t> >::iterator> index;
+} memoryCache_t;
+
+typedef struct
+{
+    std::atomic<long> requests;
+    std::atomic<long> errors;
+    std::atomic<long> hits;
+    std::atomic<long> misses;
+    std::atomic<long> bytes;
+    std::atomic<long> latency[SERVER_BUCKETS];
+    std::atomic<long> totalMicros;
+} serverMetrics_t;
+
+static blob_t cacheGet(memoryCache_t& cache, const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(cache.lock);
+    auto it = cache.index.find(key);
+    if (it == cache.index.end()) {
+        return blob_t();
+    }
+    cache.order.splice(cache.order.begin(), cache.order, it->second);
+    return it->second->second;
+}
+
+static void cachePut(memoryCache_t& cache, const std::string& key, const blob_t& blob)
+{
+    long size = long(blob->size() + key.size());
+    if (size > cache.maxBytes) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(cache.lock);
+    if (cache.index.count(key)) {
+        return; /* another request made it meanwhile */
+    }
+    cache.order.push_front(std::make_pair(key, blob));
+    cache.index[key] = cache.order.begin();
+    cache.bytes += size;
+    while (cache.bytes > cache.maxBytes) {
+        const std::pair<std::string, blob_t>& last = cache.order.back();
+        cache.bytes -= long(last.second->size() + last.first.size());
+        cache.index.erase(last.first);
+        cache.order.pop_back();
+    }
+}
+
+static const char *contentType(const std::string& path)
+{
+    const char *name = path.c_str();
+    if (hasExtension(name, ".png")) {
+        return "image/png";
+    } else if (hasExtension(name, ".wav")) {
+        return "audio/wav";
+    } else if (hasExtension(name, ".txt") || hasExtension(name, ".cfg")) {
+        return "text/plain";
+    } else if (hasExtension(name, ".json")) {
+        return "application/json";
+    }
+    return "application/octet-stream";
+}
+
+static bool sendAll(int fd, const void *data, size_t length)
+{
+    const char *p = (const char *)data;
+    while (length > 0) {
+        ssize_t n = send(fd, p, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        length -= size_t(n);
+    }
+    return true;
+}
+
+static void sendResponse(int fd, int status, const char *type, const void *data, size_t length)
+{
+    const char *reason = status == 200 ? "OK" : status == 400 ? "Bad Request" : status == 404 ? "Not Found" :
+        status == 405 ? "Method Not Allowed" : "Internal Server Error";
+    char header[256];
+    int l = snprintf(header, sizeof(header),
+                     "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+                     status, reason, type, (unsigned long)length);
+    if (sendAll(fd, header, size_t(l)) && length > 0) {
+        sendAll(fd, data, length);
+    }
+}
+
+static void sendStatus(int fd, int status)
+{
+    char body[32];
+    int l = snprintf(body, sizeof(body), "%d\n", status);
+    sendResponse(fd, status, "text/plain", body, size_t(l));
+}
+
+/*
+ * Decode %xx escapes, refusing anything leaving the tree.
+ */
+static bool decodePath(const char *s, size_t len, std::string& path)
+{
+    path.clear();
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '%' && i + 2 < len && isxdigit((unsigned char)s[i + 1]) && isxdigit((unsigned char)s[i + 2])) {
+            char hex[3] = { s[i + 1], s[i + 2], 0 };
+            path += char(strtol(hex, NULL, 16));
+            i += 2;
+        } else if (s[i] == '?' || s[i] == '#') {
+            break;
+        } else {
+            path += s[i];
+        }
+    }
+    while (!path.empty() && path[0] == '/') {
+        path.erase(0, 1);
+    }
+    return path.find('\0') == std::string::npos && path.find("..") == std::string::npos;
+}
+
+/*
+ * Latency below which the given fraction of the requests were.
+ */
+static long percentile(const serverMetrics_t& metrics, double fraction)
+{
+    long total = 0;
+    for (int i = 0; i < SERVER_BUCKETS; i++) {
+        total += metrics.latency[i];
+    }
+    long seen = 0;
+    for (int i = 0; i < SERVER_BUCKETS; i++) {
+        seen += metrics.latency[i];
+        if (total > 0 && seen >= total * fraction) {
+            return 1L << i;
+        }
+    }
+    return 0;
+}
+
+static void sendMetrics(int fd, const serverMetrics_t& metrics, memoryCache_t& cache)
+{
+    long cached, entries;
+    {
+        std::lock_guard<std::mutex> lock(cache.lock);
+        cached = cache.bytes;
+        entries = long(cache.order.size());
+    }
+    long requests = metrics.requests;
+    char body[1024];
+    int l = snprintf(body, sizeof(body),
+                     "requests %ld\nerrors %ld\ncache_hits %ld\ncache_misses %ld\ncache_entries %ld\n"
+                     "cache_bytes %ld\nbytes_sent %ld\nlatency_mean_us %ld\nlatency_p50_us %ld\n"
+                     "latency_p90_us %ld\nlatency_p99_us %ld\n",
+                     requests, long(metrics.errors), long(metrics.hits), long(metrics.misses), entries, cached,
+                     long(metrics.bytes), requests > 0 ? long(metrics.totalMicros) / requests : 0L,
+                     percentile(metrics, 0.5), percentile(metrics, 0.9), percentile(metrics, 0.99));
+    sendResponse(fd, 200, "text/plain", body, size_t(l));
+}
+
+static void handleConnection(int fd, const serveResolver_t& resolve, memoryCache_t& cache, serverMetrics_t& metrics)
+{
+    struct timeval tv;
+    tv.tv_sec = SERVER_TIMEOUT;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    /* a client that stops reading would otherwise hold a worker for ever */
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    /* only the request line is needed, the headers are read and ignored */
+    char request[SERVER_MAX_REQUEST];
+    size_t len = 0;
+    while (len < sizeof(request) - 1) {
+        ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (n <= 0) {
+            return;
+        }
+        len += size_t(n);
+        request[len] = 0;
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+            break;
+        }
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const char *target = strchr(request, ' ');
+    const char *end = target != NULL ? strchr(target + 1, ' ') : NULL;
+    std::string path;
+    int status = 200;
+    if (target == NULL || end == NULL || !decodePath(target + 1, size_t(end - target - 1), path)) {
+        status = 400;
+        sendStatus(fd, status);
+    } else if (strncmp(request, "GET ", 4) != 0) {
+        status = 405;
+        sendStatus(fd, status);
+    } else if (path == "metrics") {
+        sendMetrics(fd, metrics, cache);
+    } else {
+        blob_t blob = cacheGet(cache, path);
+        if (blob) {
+            metrics.hits++;
+        } else {
+            metrics.misses++;
+            std::shared_ptr<std::vector<byte> > data(new std::vector<byte>());
+            status = resolve(path, *data);
+            if (status == 200) {
+                blob = data;
+                cachePut(cache, path, blob);
+            }
+        }
+        if (status == 200) {
+            sendResponse(fd, 200, contentType(path), blob->data(), blob->size());
+            metrics.bytes += long(blob->size());
+        } else {
+            sendStatus(fd, status);
+        }
+    }
+
+    long micros = long(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    int bucket = 0;
+    while (bucket < SERVER_BUCKETS - 1 && (1L << bucket) <= micros) {
+        bucket++;
+    }
+    metrics.latency[bucket]++;
+    metrics.totalMicros += micros;
+    metrics.requests++;
+    if (status != 200) {
+        metrics.errors++;
+    }
+}
+
+static int openSocket(const char *address)
+{
+    int fd;
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        if (strlen(address + 5) >= sizeof(sa.sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", address + 5);
+            return -1;
+        }
+        strcpy(sa.sun_path, address + 5);
+        unlink(sa.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+            fprintf(stderr, "Cannot bind %s: %s\n", address, strerror(errno));
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+    } else {
+        int port = atoi(address);
+        if (port <= 0 || port > 65535) {
+            fprintf(stderr, "Bad port %s\n", address);
+            return -1;
+        }
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK); /* local use only */
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        if (fd >= 0) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+            fprintf(stderr, "Cannot bind %s: %s\n", address, strerror(errno));
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+    }
+    if (listen(fd, 64) != 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", address, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool serveFiles(const char *address, long cacheBytes, const serveResolver_t& resolve)
+{
+    int listener = openSocket(address);
+    if (listener < 0) {
+        return false;
+    }
+
+    memoryCache_t cache;
+    cache.maxBytes = cacheBytes;
+    cache.bytes = 0;
+    serverMetrics_t metrics;
+    metrics.requests = metrics.errors = metrics.hits = metrics.misses = metrics.bytes = metrics.totalMicros = 0;
+    for (int i = 0; i < SERVER_BUCKETS; i++) {
+        metrics.latency[i] = 0;
+    }
+
+    /* a fixed set of workers takes the accepted connections in turn */
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<int> pending;
+    int numThreads = int(std::thread::hardware_concurrency());
+    if (numThreads < 4) {
+        numThreads = 4;
+    }
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++) {
+        threads.push_back(std::thread([&]() {
+            for (;;) {
+                int fd;
+                {
+                    std::unique_lock<std::mutex> l(lock);
+                    ready.wait(l, [&]() { return !pending.empty(); });
+                    fd = pending.front();
+                    pending.pop_front();
+                }
+                if (fd < 0) {
+                    return;
+                }
+                handleConnection(fd, resolve, cache, metrics);
+                close(fd);
+            }
+        }));
+    }
+
+    printf("Serving on %s\n", address);
+    fflush(stdout);
+    bool r = true;
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                usleep(10000); /* wait for connections to finish */
+                continue;
+            }
+            fprintf(stderr, "Accept failed: %s\n", strerror(errno));
+            r = false;
+            break;
+        }
+        std::lock_guard<std::mutex> l(lock);
+        pending.push_back(fd);
+        ready.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        for (int i = 0; i < numThreads; i++) {
+            pending.push_back(-1);
+        }
+        ready.notify_all();
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    close(listener);
+    return r;
+}
@@ -0,0 +1,51 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Serving files over HTTP
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_SERVER_H
+#define Q2UNPACK_SERVER_H
+
+#include <string>
+#include "common.h"
+
+/* Default size of the memory cache in megabytes */
+#define SERVER_DEFAULT_CACHE 64
+
+/*
+ * Produce the file for a request path, without the leading slash.
+ * Returns an HTTP status, data is only used with 200. Called from
+ * several threads at once.
+ */
+typedef std::function<int(const std::string& path, std::vector<byte>& data)> serveResolver_t;
+
+/*
+ * Serve GET requests on address until killed. The address is a port
+ * on localhost or "unix:" and a socket path. Resolved files are kept
+ * in a memory cache of at most cacheBytes, dropping the least recently
+ * used first. GET /metrics reports request counts and latencies.
+ */
+bool serveFiles(const char *address, long cacheBytes, const serveResolver_t& resolve);
+
+#endif
@@ -0,0 +1,469 @@
+/*
+* Copyright (C) 1997-2001 Id Software, Inc.
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include "flac.h"
+#include "sound.h"
+
+/* Filter taps per output sample */
+#define RESAMPLE_TAPS 32
+
+/* Peak level after normalizing */
+#define NORMALIZE_PEAK 0.95f
+
+static int getLittleLong(const byte *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+
+static short getLittleShort(const byte *p)
+{
+    return short(p[0] | (p[1] << 8));
+}
+
+/*
+ * Find a chunk from the RIFF chunk list, NULL if not found.
+ */
+static const byte *findChunk(const byte *start, const byte *end, const char *name, int *length)
+{
+    const byte *p = start;
+    while (p + 8 <= end) {
+        int len = getLittleLong(p + 4);
+        if (len < 0 || len > end - p - 8) {
+            return NULL;
+        }
+        if (memcmp(p, name, 4) == 0) {
+            *length = len;
+            return p + 8;
+        }
+        p += 8 + ((len + 1) & ~1);
+    }
+    return NULL;
+}
+
+bool parseWav(const byte *data, long length, const char *name, wavinfo_t *info)
+{
+    const byte *end = data + length;
+    if (length < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "Missing RIFF/WAVE chunks in %s\n", name);
+        return false;
+    }
+
+    int fmtlen;
+    const byte *fmt = findChunk(data + 12, end, "fmt ", &fmtlen);
+    if (fmt == NULL || fmtlen < 16) {
+        fprintf(stderr, "Missing fmt chunk in %s\n", name);
+        return false;
+    }
+    if (getLittleShort(fmt) != 1) {
+        fprintf(stderr, "Microsoft PCM format only in %s\n", name);
+        return false;
+    }
+
+    info->channels = getLittleShort(fmt + 2);
+    info->rate = getLittleLong(fmt + 4);
+    info->width = getLittleShort(fmt + 14) / 8;
+    if (info->channels < 1 || info->channels > 2 || info->rate <= 0 ||
+        (info->width != 1 && info->width != 2)) {
+        fprintf(stderr, "Unsupported format in %s\n", name);
+        return false;
+    }
+
+    /* get cue chunk */
+    int cuelen;
+    const byte *cue = findChunk(data + 12, end, "cue ", &cuelen);
+    info->loopstart = -1;
+    if (cue != NULL && cuelen >= 28 && getLittleLong(cue) > 0) {
+        info->loopstart = getLittleLong(cue + 24);
+    }
+
+    int datalen;
+    info->data = findChunk(data + 12, end, "data", &datalen);
+    if (info->data == NULL) {
+        fprintf(stderr, "Missing data chunk in %s\n", name);
+        return false;
+    }
+    info->samples = datalen / (info->width * info->channels);
+    if (info->loopstart >= info->samples) {
+        info->loopstart = -1;
+    }
+    return true;
+}
+
+bool loadSound(const fileEntry& entry, soundData_t *sound)
+{
+    byte *data = loadEntry(entry);
+    if (data == NULL) {
+        return false;
+    }
+
+    wavinfo_t info;
+    if (!parseWav(data, entry.length, entry.name, &info)) {
+        free(data);
+        return false;
+    }
+
+    sound->rate = info.rate;
+    sound->channels = info.channels;
+    sound->samples = info.samples;
+    sound->loopstart = info.loopstart;
+    sound->bits = info.width * 8;
+    sound->pcm.resize(size_t(info.samples) * info.channels);
+    for (int c = 0; c < info.channels; c++) {
+        float *dst = &sound->pcm[size_t(c) * info.samples];
+        for (int i = 0; i < info.samples; i++) {
+            const byte *p = info.data + (size_t(i) * info.channels + c) * info.width;
+            if (info.width == 1) {
+                dst[i] = (int(p[0]) - 128) * (1.0f / 128);
+            } else {
+                dst[i] = getLittleShort(p) * (1.0f / 32768);
+            }
+        }
+    }
+    free(data);
+    return true;
+}
+
+static int gcd(int a, int b)
+{
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+void resampleSound(soundData_t *sound, int rate)
+{
+    if (rate == sound->rate || sound->samples == 0) {
+        return;
+    }
+
+    /* up by L, down by M */
+    int g = gcd(rate, sound->rate);
+    int L = rate / g;
+    int M = sound->rate / g;
+
+    /* prototype low pass at the upsampled rate, cut below the lower
+       of the two nyquist frequencies */
+    int N = RESAMPLE_TAPS * L;
+    int delay = N / 2;
+    double fc = 0.5 / (L > M ? L : M) * 0.92;
+    std::vector<double> proto(N);
+    for (int i = 0; i < N; i++) {
+        double x = i - delay;
+        double sinc = x == 0 ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x);
+        double w = 0.42 + 0.5 * cos(M_PI * x / delay) + 0.08 * cos(2 * M_PI * x / delay);
+        proto[i] = sinc * w * L;
+    }
+
+    /* split to phases, each reversed so the inner loop is a plain dot
+       product over consecutive input samples */
+    std::vector<float> phases(size_t(L) * RESAMPLE_TAPS);
+    for (int p = 0; p < L; p++) {
+        for (int k = 0; k < RESAMPLE_TAPS; k++) {
+            phases[size_t(p) * RESAMPLE_TAPS + (RESAMPLE_TAPS - 1 - k)] = float(proto[p + k * L]);
+        }
+    }
+
+    long outsamples = (long(sound->samples) * L + M - 1) / M;
+    std::vector<float> out(size_t(outsamples) * sound->channels);
+    std::vector<float> padded(size_t(sound->samples) + 2 * RESAMPLE_TAPS + 2, 0.0f);
+
+    for (int c = 0; c < sound->channels; c++) {
+        memcpy(&padded[RESAMPLE_TAPS], &sound->pcm[size_t(c) * sound->samples], sound->samples * sizeof(float));
+        float *dst = &out[size_t(c) * outsamples];
+
+        for (long n = 0; n < outsamples; n++) {
+            long t = n * M + delay;
+            long base = t / L;
+            int p = int(t % L);
+            const float *coef = &phases[size_t(p) * RESAMPLE_TAPS];
+            const float *x = &padded[base + 1];
+            if (base + 1 + RESAMPLE_TAPS > long(padded.size())) {
+                dst[n] = 0;
+                continue;
+            }
+
+            /* four partial sums keep the loop vectorizable */
+            float acc[4] = {0, 0, 0, 0};
+            for (int k = 0; k < RESAMPLE_TAPS; k += 4) {
+                acc[0] += coef[k + 0] * x[k + 0];
+                acc[1] += coef[k + 1] * x[k + 1];
+                acc[2] += coef[k + 2] * x[k + 2];
+                acc[3] += coef[k + 3] * x[k + 3];
+            }
+            dst[n] = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+        }
+    }
+
+    if (sound->loopstart >= 0) {
+        sound->loopstart = int(long(sound->loopstart) * L / M);
+    }
+    sound->pcm.swap(out);
+    sound->samples = int(outsamples);
+    sound->rate = rate;
+    sound->bits = 16;
+}
+
+void normalizeSound(soundData_t *sound)
+{
+    float peak = 0;
+    for (float v : sound->pcm) {
+        if (fabsf(v) > peak) {
+            peak = fabsf(v);
+        }
+    }
+    if (peak <= 0) {
+        return;
+    }
+    float scale = NORMALIZE_PEAK / peak;
+    for (float& v : sound->pcm) {
+        v *= scale;
+    }
+    sound->bits = 16;
+}
+
+/*
+ * Back to an integer sample, exact for values loadSound produced.
+ */
+static int32_t sampleValue(float v, int bits)
+{
+    float scale = float(1 << (bits - 1));
+    v *= scale;
+    v = v > scale - 1 ? scale - 1 : v < -scale ? -scale : v;
+    return int32_t(lrintf(v));
+}
+
+static void putLittleLong(std::vector<byte>& out, int v)
+{
+    out.push_back(byte(v));
+    out.push_back(byte(v >> 8));
+    out.push_back(byte(v >> 16));
+    out.push_back(byte(v >> 24));
+}
+
+static void putLittleShort(std::vector<byte>& out, int v)
+{
+    out.push_back(byte(v));
+    out.push_back(byte(v >> 8));
+}
+
+bool writeWav(const char *path, const soundData_t *sound)
+{
+    int datalen = sound->samples * sound->channels * 2;
+    std::vector<byte> out;
+    out.reserve(datalen + 128);
+
+    out.insert(out.end(), (const byte *)"RIFF", (const byte *)"RIFF" + 4);
+    putLittleLong(out, 0); /* patched below */
+    out.insert(out.end(), (const byte *)"WAVE", (const byte *)"WAVE" + 4);
+
+    out.insert(out.end(), (const byte *)"fmt ", (const byte *)"fmt " + 4);
+    putLittleLong(out, 16);
+    putLittleShort(out, 1);
+    putLittleShort(out, sound->channels);
+    putLittleLong(out, sound->rate);
+    putLittleLong(out, sound->rate * sound->channels * 2);
+    putLittleShort(out, sound->channels * 2);
+    putLittleShort(out, 16);
+
+    if (sound->loopstart >= 0) {
+        out.insert(out.end(), (const byte *)"cue ", (const byte *)"cue " + 4);
+        putLittleLong(out, 28);
+        putLittleLong(out, 1);                /* cue points */
+        putLittleLong(out, 1);                /* id */
+        putLittleLong(out, sound->loopstart); /* position */
+        out.insert(out.end(), (const byte *)"data", (const byte *)"data" + 4);
+        putLittleLong(out, 0);                /* chunk start */
+        putLittleLong(out, 0);                /* block start */
+        putLittleLong(out, sound->loopstart); /* sample offset */
+    }
+
+    out.insert(out.end(), (const byte *)"data", (const byte *)"data" + 4);
+    putLittleLong(out, datalen);
+    for (int i = 0; i < sound->samples; i++) {
+        for (int c = 0; c < sound->channels; c++) {
+            putLittleShort(out, sampleValue(sound->pcm[size_t(c) * sound->samples + i], 16));
+        }
+    }
+
+    int riff = int(out.size()) - 8;
+    for (int i = 0; i < 4; i++) {
+        out[4 + i] = byte(riff >> (i * 8));
+    }
+
+    FILE *f = createOutputFile(path);
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return false;
+    }
+    bool r = fwrite(out.data(), 1, out.size(), f) == out.size();
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+/* A sound waiting for its FLAC frames */
+typedef struct
+{
+    const fileEntry *entry;
+    flacStream_t stream;
+    std::vector<int32_t> pcm; /* channels one after another */
+    int firstframe;           /* in the frame list of all sounds */
+    int numframes;
+} flacSound_t;
+
+static bool writeFlacSound(const char *outPath, const flacSound_t *sound,
+                           const std::vector<std::vector<byte> >& frames, long *length)
+{
+    int minframe = 0, maxframe = 0;
+    for (int i = 0; i < sound->numframes; i++) {
+        int size = int(frames[sound->firstframe + i].size());
+        minframe = i == 0 || size < minframe ? size : minframe;
+        maxframe = size > maxframe ? size : maxframe;
+    }
+    std::vector<byte> header;
+    writeFlacHeader(&sound->stream, minframe, maxframe, header);
+
+    char fullpath[1024];
+    if (!createOutputPath(outPath, sound->entry->name, ".flac", fullpath, sizeof(fullpath))) {
+        return false;
+    }
+    FILE *f = createOutputFile(fullpath);
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", fullpath);
+        return false;
+    }
+    bool r = fwrite(header.data(), 1, header.size(), f) == header.size();
+    *length = long(header.size());
+    for (int i = 0; i < sound->numframes && r; i++) {
+        const std::vector<byte>& frame = frames[sound->firstframe + i];
+        r = fwrite(frame.data(), 1, frame.size(), f) == frame.size();
+        *length += long(frame.size());
+    }
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", fullpath);
+        return false;
+    }
+    return true;
+}
+
+bool convertSounds(const char *outPath, const std::vector<bool>& selected, int rate, bool normalize,
+                   soundFormat_t format)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<const fileEntry *> sounds;
+    long inbytes = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        const fileEntry& entry = entries[i];
+        if (selected[i] && strncmp(entry.name, "sound/", 6) == 0 && hasExtension(entry.name, ".wav") &&
+            findEntry(entry.name) == &entry) {
+            sounds.push_back(&entry);
+            inbytes += entry.length;
+        }
+    }
+
+    std::vector<flacSound_t> flacs(format == SOUND_FLAC ? sounds.size() : 0);
+    std::vector<long> outbytes(sounds.size(), 0);
+    bool r = parallelFor(int(sounds.size()), [&](int i) {
+        const fileEntry& entry = *sounds[i];
+        soundData_t sound;
+        if (!loadSound(entry, &sound)) {
+            return false;
+        }
+        if (rate > 0) {
+            resampleSound(&sound, rate);
+        }
+        if (normalize) {
+            normalizeSound(&sound);
+        }
+
+        if (format == SOUND_FLAC) {
+            /* frames are encoded below, over all sounds at once */
+            flacSound_t& flac = flacs[i];
+            flac.entry = &entry;
+            flac.stream.rate = sound.rate;
+            flac.stream.channels = sound.channels;
+            flac.stream.bps = sound.bits;
+            flac.stream.samples = sound.samples;
+            flac.pcm.resize(sound.pcm.size());
+            for (size_t j = 0; j < sound.pcm.size(); j++) {
+                flac.pcm[j] = sampleValue(sound.pcm[j], sound.bits);
+            }
+            return true;
+        }
+
+        char fullpath[1024];
+        if (!createOutputPath(outPath, entry.name, NULL, fullpath, sizeof(fullpath)) ||
+            !writeWav(fullpath, &sound)) {
+            return false;
+        }
+        outbytes[i] = 44 + long(sound.pcm.size()) * 2;
+        return true;
+    });
+
+    if (r && format == SOUND_FLAC) {
+        std::vector<std::pair<int, int> > jobs; /* sound, frame */
+        for (size_t i = 0; i < flacs.size(); i++) {
+            flacs[i].firstframe = int(jobs.size());
+            flacs[i].numframes = int((flacs[i].stream.samples + FLAC_BLOCKSIZE - 1) / FLAC_BLOCKSIZE);
+            for (int j = 0; j < flacs[i].numframes; j++) {
+                jobs.push_back(std::make_pair(int(i), j));
+            }
+        }
+
+        std::vector<std::vector<byte> > frames(jobs.size());
+        r = parallelFor(int(jobs.size()), [&](int i) {
+            const flacSound_t& flac = flacs[jobs[i].first];
+            long first = long(jobs[i].second) * FLAC_BLOCKSIZE;
+            long left = flac.stream.samples - first;
+            const int32_t *channels[2];
+            for (int c = 0; c < flac.stream.channels; c++) {
+                channels[c] = &flac.pcm[c * flac.stream.samples + first];
+            }
+            encodeFlacFrame(&flac.stream, channels, left < FLAC_BLOCKSIZE ? int(left) : FLAC_BLOCKSIZE,
+                            unsigned(jobs[i].second), frames[i]);
+            return true;
+        });
+
+        if (r) {
+            r = parallelFor(int(flacs.size()), [&](int i) {
+                return writeFlacSound(outPath, &flacs[i], frames, &outbytes[i]);
+            });
+        }
+    }
+
+    long total = 0;
+    for (long n : outbytes) {
+        total += n;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Sounds: %lu files, %ld -> %ld bytes in %.3f s (%.1f MB/s)\n", sounds.size(), inbytes, total,
+           seconds, seconds > 0 ? inbytes / seconds / (1024 * 1024) : 0.0);
+    return r;
+}
@@ -0,0 +1,94 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  WAV parsing, resampling and writing
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_SOUND_H
+#define Q2UNPACK_SOUND_H
+
+#include "common.h"
+
+typedef struct
+{
+    int rate;
+    int width;       /* bytes per sample, 1 or 2 */
+    int channels;
+    int samples;     /* per channel */
+    int loopstart;   /* -1 if the sound does not loop */
+    const byte *data; /* interleaved PCM inside the parsed file */
+} wavinfo_t;
+
+/* Decoded sound, channels are stored one after another */
+typedef struct
+{
+    int rate;
+    int channels;
+    int samples;
+    int loopstart;
+    int bits;               /* of the source, 16 once processed */
+    std::vector<float> pcm;
+} soundData_t;
+
+typedef enum
+{
+    SOUND_WAV,
+    SOUND_FLAC
+} soundFormat_t;
+
+/*
+ * Parse the RIFF header of a PCM WAV file like GetWavinfo does.
+ */
+bool parseWav(const byte *data, long length, const char *name, wavinfo_t *info);
+
+/*
+ * Load and decode a WAV entry to floats in [-1, 1].
+ */
+bool loadSound(const fileEntry& entry, soundData_t *sound);
+
+/*
+ * Resample to a new rate with a windowed sinc polyphase filter.
+ */
+void resampleSound(soundData_t *sound, int rate);
+
+/*
+ * Scale the sound so its peak is just below full scale.
+ */
+void normalizeSound(soundData_t *sound);
+
+/*
+ * Write the sound as 16 bit PCM WAV, keeping the loop start in a cue
+ * chunk.
+ */
+bool writeWav(const char *path, const soundData_t *sound);
+
+/*
+ * Convert every selected WAV entry under sound/, resampling to the
+ * given rate (0 keeps the rate). WAV output is 16 bit PCM, FLAC keeps
+ * the bit depth of unprocessed sounds. Files and the FLAC frames
+ * within them are encoded in parallel.
+ */
+bool convertSounds(const char *outPath, const std::vector<bool>& selected, int rate, bool normalize,
+                   soundFormat_t format);
+
+#endif
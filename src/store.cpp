@@ -0,0 +1,112 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "checksum.h"
+#include "store.h"
+
+static bool writeBlob(const char *path, const std::vector<byte>& data)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return false;
+    }
+    bool r = fwrite(data.data(), 1, data.size(), f) == data.size();
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        unlink(path);
+        return false;
+    }
+    return true;
+}
+
+bool storeFile(const char *storePath, const char *outPath, const char *name, const std::vector<byte>& data,
+               storeStats_t& stats)
+{
+    uint64_t hash = xxh64(data.data(), data.size(), 0);
+    char blobName[64];
+    snprintf(blobName, sizeof(blobName), "%02x/%014llx-%lu", unsigned(hash >> 56),
+             (unsigned long long)(hash & 0xffffffffffffffULL), (unsigned long)data.size());
+    char blob[1024];
+    if (!createOutputPath(storePath, blobName, NULL, blob, sizeof(blob))) {
+        return false;
+    }
+
+    stats.files++;
+    stats.bytes += long(data.size());
+    struct stat st;
+    if (stat(blob, &st) != 0) {
+        /* written aside first, so a blob is either whole or missing */
+        std::string temp = tempPath(blob);
+        if (!writeBlob(temp.c_str(), data)) {
+            return false;
+        }
+        /* read only, so writing to a linked output cannot change the blob */
+        if (chmod(temp.c_str(), 0444) != 0) {
+            fprintf(stderr, "Failed to store %s\n", blob);
+            unlink(temp.c_str());
+            return false;
+        }
+        /* linking instead of renaming tells if another writer got there first */
+        bool stored = link(temp.c_str(), blob) == 0;
+        int err = errno;
+        unlink(temp.c_str());
+        if (!stored && err != EEXIST) {
+            fprintf(stderr, "Failed to store %s\n", blob);
+            return false;
+        }
+        if (stored) {
+            stats.newBlobs++;
+            stats.newBytes += long(data.size());
+        }
+    }
+
+    char fullpath[1024];
+    if (!createOutputPath(outPath, name, NULL, fullpath, sizeof(fullpath))) {
+        return false;
+    }
+    unlink(fullpath);
+    if (link(blob, fullpath) == 0) {
+        return true;
+    }
+    if (errno != EXDEV && errno != EMLINK && errno != EPERM) {
+        fprintf(stderr, "Failed to link %s\n", fullpath);
+        return false;
+    }
+    /* different file system or too many links */
+    stats.copies++;
+    return writeBlob(fullpath, data);
+}
+
+void reportStore(const storeStats_t& stats)
+{
+    long saved = stats.bytes - stats.newBytes;
+    printf("Store: %ld files, %ld bytes, %ld new blobs with %ld bytes, %ld bytes deduplicated (%.1f%%)",
+           long(stats.files), long(stats.bytes), long(stats.newBlobs), long(stats.newBytes), saved,
+           stats.bytes > 0 ? 100.0 * saved / stats.bytes : 0.0);
+    if (stats.copies > 0) {
+        printf(", %ld copied instead of linked", long(stats.copies));
+    }
+    printf("\n");
+}
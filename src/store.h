@@ -0,0 +1,60 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Content addressed output store
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_STORE_H
+#define Q2UNPACK_STORE_H
+
+#include <atomic>
+#include "common.h"
+
+/* Every distinct file is kept once as <store>/<2 hex>/<14 hex>-<size>,
+ * named by its xxh64, and the output tree is made of hard links to
+ * them. Blobs are never changed once written and are read only, so
+ * several trees and runs can share a store. Writers replace an output
+ * file instead of writing into it, which leaves the blob alone. */
+
+typedef struct
+{
+    std::atomic<long> files;
+    std::atomic<long> bytes;
+    std::atomic<long> newBlobs;
+    std::atomic<long> newBytes;
+    std::atomic<long> copies; /* links that fell back to copies */
+} storeStats_t;
+
+/*
+ * Put data to the store unless it is there and link it to name under
+ * outPath. Safe to call from several threads and processes.
+ */
+bool storeFile(const char *storePath, const char *outPath, const char *name, const std::vector<byte>& data,
+               storeStats_t& stats);
+
+/*
+ * Print how much the store saved.
+ */
+void reportStore(const storeStats_t& stats);
+
+#endif
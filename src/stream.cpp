@@ -0,0 +1,331 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <algorithm>
+#include <unordered_set>
+#include <unistd.h>
+#include "stream.h"
+
+#define STREAM_BUFFER_SIZE 0x100000
+
+/*
+ * Read exactly length bytes unless the stream ends.
+ */
+static bool readStream(int fd, void *buffer, size_t length)
+{
+    byte *p = (byte *)buffer;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        length -= size_t(n);
+    }
+    return true;
+}
+
+/*
+ * Pass length bytes of the stream to out, or drop them if out is NULL.
+ */
+static bool copyStream(int fd, FILE *out, long length, std::vector<byte>& buffer)
+{
+    while (length > 0) {
+        size_t len = length < long(buffer.size()) ? size_t(length) : buffer.size();
+        if (!readStream(fd, buffer.data(), len)) {
+            fprintf(stderr, "Unexpected end of pak stream\n");
+            return false;
+        }
+        if (out != NULL && fwrite(buffer.data(), 1, len, out) != len) {
+            return false;
+        }
+        length -= long(len);
+    }
+    return true;
+}
+
+static bool readStreamHeader(int fd, const char *name, dpackheader_t *header)
+{
+    if (!readStream(fd, header, sizeof(*header)) || LittleLong(header->ident) != IDPAKHEADER) {
+        fprintf(stderr, "%s is not a pack file\n", name);
+        return false;
+    }
+    header->dirofs = LittleLong(header->dirofs);
+    header->dirlen = LittleLong(header->dirlen);
+    int numFiles = header->dirlen / int(sizeof(dpackfile_t));
+    if (header->dirofs < int(sizeof(*header)) || header->dirlen % sizeof(dpackfile_t) != 0 ||
+        numFiles > MAX_FILES_IN_PACK || numFiles == 0) {
+        fprintf(stderr, "%s has a bad directory\n", name);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Check the directory and terminate the names.
+ */
+static bool checkDirectory(std::vector<dpackfile_t>& dir, const char *name)
+{
+    for (dpackfile_t& file : dir) {
+        file.name[sizeof(file.name) - 1] = 0;
+        file.filepos = LittleLong(file.filepos);
+        file.filelen = LittleLong(file.filelen);
+        if (file.filepos < 0 || file.filelen < 0 || file.filepos > 0x7fffffff - file.filelen) {
+            fprintf(stderr, "%s: bad entry %s\n", name, file.name);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool spoolPakStream(int fd, const char *name)
+{
+    dpackheader_t header;
+    if (!readStreamHeader(fd, name, &header)) {
+        return false;
+    }
+
+    FILE *spool = tmpfile();
+    if (spool == NULL) {
+        fprintf(stderr, "Cannot create a spool file for %s\n", name);
+        return false;
+    }
+
+    /* the header is kept so the offsets stay as they are */
+    dpackheader_t raw = header;
+    raw.ident = LittleLong(IDPAKHEADER);
+    raw.dirofs = LittleLong(header.dirofs);
+    raw.dirlen = LittleLong(header.dirlen);
+    std::vector<byte> buffer(STREAM_BUFFER_SIZE);
+    long pos = header.dirofs + header.dirlen;
+    if (fwrite(&raw, sizeof(raw), 1, spool) != 1 || !copyStream(fd, spool, pos - long(sizeof(raw)), buffer) ||
+        fflush(spool) != 0) {
+        fprintf(stderr, "Failed to spool %s\n", name);
+        fclose(spool);
+        return false;
+    }
+
+    std::vector<dpackfile_t> dir(header.dirlen / sizeof(dpackfile_t));
+    if (pread(fileno(spool), dir.data(), header.dirlen, header.dirofs) != header.dirlen ||
+        !checkDirectory(dir, name)) {
+        fclose(spool);
+        return false;
+    }
+
+    /* files may also come after the directory */
+    long end = pos;
+    for (const dpackfile_t& file : dir) {
+        end = std::max(end, long(file.filepos) + file.filelen);
+    }
+    if (!copyStream(fd, spool, end - pos, buffer) || fflush(spool) != 0) {
+        fprintf(stderr, "Failed to spool %s\n", name);
+        fclose(spool);
+        return false;
+    }
+
+    for (const dpackfile_t& file : dir) {
+        fileEntry entry;
+        strcpy(entry.name, file.name);
+        entry.file = spool;
+        entry.offset = file.filepos;
+        entry.length = file.filelen;
+        entry.source = name;
+        entries.push_back(entry);
+    }
+    printf("Added packfile '%s' (%lu files, %ld bytes spooled).\n", name, dir.size(), end);
+    return true;
+}
+
+static bool fileposLess(const dpackfile_t& a, const dpackfile_t& b)
+{
+    return a.filepos < b.filepos;
+}
+
+/*
+ * A file being written while its bytes go by.
+ */
+typedef struct
+{
+    FILE *file;
+    long end;
+    std::string path;
+} streamOutput_t;
+
+/*
+ * Read the header and directory of a pak from a file, as the first
+ * bytes of the pak followed by its directory.
+ */
+static bool readDirectoryFile(const char *dirPath, dpackheader_t *header, std::vector<dpackfile_t>& dir)
+{
+    FILE *f = fopen(dirPath, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", dirPath);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    bool r = length > long(sizeof(*header)) && fread(header, sizeof(*header), 1, f) == 1 &&
+        LittleLong(header->ident) == IDPAKHEADER;
+    if (r) {
+        header->dirofs = LittleLong(header->dirofs);
+        header->dirlen = LittleLong(header->dirlen);
+        r = header->dirlen == length - long(sizeof(*header)) && header->dirlen % sizeof(dpackfile_t) == 0;
+    }
+    if (r) {
+        dir.resize(header->dirlen / sizeof(dpackfile_t));
+        r = fread(dir.data(), sizeof(dpackfile_t), dir.size(), f) == dir.size();
+    }
+    fclose(f);
+    if (!r || !checkDirectory(dir, dirPath)) {
+        fprintf(stderr, "%s is not the header and directory of a pak\n", dirPath);
+        return false;
+    }
+    return true;
+}
+
+static void closeOutputs(std::vector<streamOutput_t>& outputs)
+{
+    for (streamOutput_t& out : outputs) {
+        fclose(out.file);
+    }
+    outputs.clear();
+}
+
+bool extractPakStream(int fd, const char *dirPath, const std::vector<entryFilter_t>& filters,
+                      const char *outPath)
+{
+    dpackheader_t expected;
+    std::vector<dpackfile_t> dir;
+    if (!readDirectoryFile(dirPath, &expected, dir)) {
+        return false;
+    }
+
+    dpackheader_t header;
+    if (!readStreamHeader(fd, "stdin", &header)) {
+        return false;
+    }
+    if (header.dirofs != expected.dirofs || header.dirlen != expected.dirlen) {
+        fprintf(stderr, "%s is not the directory of this pak\n", dirPath);
+        return false;
+    }
+
+    /* first one of a name wins, as with the paks on disk */
+    std::vector<dpackfile_t> files;
+    std::unordered_set<std::string> names;
+    int bad = 0;
+    for (const dpackfile_t& file : dir) {
+        if (!names.insert(lowerName(file.name)).second || !filterMatch(filters, file.name)) {
+            continue;
+        }
+        /* the header has gone by before any file can start */
+        if (file.filepos < long(sizeof(header)) && file.filelen > 0) {
+            fprintf(stderr, "%s starts inside the pak header\n", file.name);
+            bad++;
+        }
+        files.push_back(file);
+    }
+    if (bad) {
+        fprintf(stderr, "%s: %d bad entries, nothing extracted\n", dirPath, bad);
+        return false;
+    }
+    std::stable_sort(files.begin(), files.end(), fileposLess);
+
+    /* Go through the stream once. Every chunk goes to all the files it
+       belongs to, so files sharing bytes are written together. */
+    std::vector<byte> buffer(STREAM_BUFFER_SIZE);
+    std::vector<streamOutput_t> outputs;
+    long pos = sizeof(header);
+    long total = 0;
+    size_t next = 0;
+    while (next < files.size() || !outputs.empty()) {
+        while (next < files.size() && (files[next].filepos <= pos || files[next].filelen == 0)) {
+            const dpackfile_t& file = files[next++];
+            streamOutput_t out;
+            char fullpath[1024];
+            if (!createOutputPath(outPath, file.name, NULL, fullpath, sizeof(fullpath))) {
+                closeOutputs(outputs);
+                return false;
+            }
+            out.file = createOutputFile(fullpath);
+            if (!out.file) {
+                fprintf(stderr, "Failed to create %s\n", fullpath);
+                closeOutputs(outputs);
+                return false;
+            }
+            if (file.filelen == 0) {
+                fclose(out.file);
+                continue;
+            }
+            out.end = long(file.filepos) + file.filelen;
+            out.path = fullpath;
+            outputs.push_back(out);
+            total += file.filelen;
+        }
+
+        /* up to where the next file starts or an open one ends */
+        long end = next < files.size() ? long(files[next].filepos) : 0x7fffffff;
+        for (const streamOutput_t& out : outputs) {
+            end = std::min(end, out.end);
+        }
+        if (outputs.empty()) {
+            if (!copyStream(fd, NULL, end - pos, buffer)) {
+                return false;
+            }
+            pos = end;
+            continue;
+        }
+        size_t len = size_t(std::min(end - pos, long(buffer.size())));
+        if (len > 0 && !readStream(fd, buffer.data(), len)) {
+            fprintf(stderr, "Unexpected end of pak stream\n");
+            closeOutputs(outputs);
+            return false;
+        }
+        pos += long(len);
+
+        size_t n = 0;
+        bool r = true;
+        for (streamOutput_t& out : outputs) {
+            bool ok = fwrite(buffer.data(), 1, len, out.file) == len;
+            if (ok && out.end > pos) {
+                outputs[n++] = out;
+                continue;
+            }
+            if (fclose(out.file) != 0 || !ok) {
+                fprintf(stderr, "Failed to write %s\n", out.path.c_str());
+                r = false;
+            }
+        }
+        outputs.resize(n);
+        if (!r) {
+            closeOutputs(outputs);
+            return false;
+        }
+    }
+
+    printf("Streamed: %lu files, %ld bytes\n", files.size(), total);
+    return true;
+}
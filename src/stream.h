@@ -0,0 +1,51 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Reading paks from pipes
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_STREAM_H
+#define Q2UNPACK_STREAM_H
+
+#include "common.h"
+#include "filter.h"
+
+/*
+ * Copy a pak from a pipe to an unlinked temporary file, up to the end
+ * of its directory or last file, and add its files to the entries like
+ * a pak on disk. Only a fixed size buffer is kept in memory.
+ */
+bool spoolPakStream(int fd, const char *name);
+
+/*
+ * Extract a pak coming from a pipe without spooling it, given its
+ * header and directory separately: the first 12 bytes of the pak
+ * followed by the dirlen bytes at dirofs, e.g. fetched with range
+ * requests. Both dirofs and dirlen must match the pak. Files are written
+ * as they go by, in file order, and entries sharing bytes are written
+ * together.
+ */
+bool extractPakStream(int fd, const char *dirPath, const std::vector<entryFilter_t>& filters,
+                      const char *outPath);
+
+#endif
@@ -0,0 +1,124 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include "tar.h"
+
+typedef struct
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+} tarHeader_t;
+
+static_assert(sizeof(tarHeader_t) == TAR_BLOCK_SIZE, "tar header must be one block");
+
+/*
+ * Fit the name to the name and prefix fields, splitting at a slash.
+ */
+static bool splitTarName(const char *name, tarHeader_t *header)
+{
+    size_t len = strlen(name);
+    if (len <= sizeof(header->name)) {
+        memcpy(header->name, name, len);
+        return true;
+    }
+    for (size_t i = len; i-- > 0; ) {
+        if (name[i] != '/') {
+            continue;
+        }
+        if (len - i - 1 > sizeof(header->name) || len - i - 1 == 0) {
+            break;
+        }
+        if (i <= sizeof(header->prefix)) {
+            memcpy(header->prefix, name, i);
+            memcpy(header->name, name + i + 1, len - i - 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool writeTarMember(FILE *out, const char *name, const void *data, size_t length)
+{
+    tarHeader_t header;
+    memset(&header, 0, sizeof(header));
+    if (!splitTarName(name, &header)) {
+        fprintf(stderr, "Name too long for tar: %s\n", name);
+        return false;
+    }
+    if (length > 077777777777UL) {
+        fprintf(stderr, "File too large for tar: %s\n", name);
+        return false;
+    }
+
+    snprintf(header.mode, sizeof(header.mode), "%07o", 0644);
+    snprintf(header.uid, sizeof(header.uid), "%07o", 0);
+    snprintf(header.gid, sizeof(header.gid), "%07o", 0);
+    snprintf(header.size, sizeof(header.size), "%011lo", (unsigned long)length);
+    snprintf(header.mtime, sizeof(header.mtime), "%011o", 0);
+    header.typeflag = '0';
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    /* the checksum is counted with its own field as spaces */
+    memset(header.chksum, ' ', sizeof(header.chksum));
+    unsigned sum = 0;
+    const unsigned char *p = (const unsigned char *)&header;
+    for (size_t i = 0; i < sizeof(header); i++) {
+        sum += p[i];
+    }
+    snprintf(header.chksum, sizeof(header.chksum), "%06o", sum);
+    header.chksum[7] = ' ';
+
+    static const char zeros[TAR_BLOCK_SIZE] = { 0 };
+    size_t padding = (TAR_BLOCK_SIZE - length % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+        (length > 0 && fwrite(data, 1, length, out) != length) ||
+        fwrite(zeros, 1, padding, out) != padding) {
+        fprintf(stderr, "Failed to write %s to tar\n", name);
+        return false;
+    }
+    return true;
+}
+
+bool finishTar(FILE *out)
+{
+    static const char zeros[TAR_BLOCK_SIZE * 2] = { 0 };
+    if (fwrite(zeros, 1, sizeof(zeros), out) != sizeof(zeros) || fflush(out) != 0) {
+        fprintf(stderr, "Failed to finish tar\n");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  POSIX tar (ustar) output
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_TAR_H
+#define Q2UNPACK_TAR_H
+
+#include "common.h"
+
+#define TAR_BLOCK_SIZE 512
+
+/*
+ * Write a regular file to the stream. Members get mode 0644 and a zero
+ * timestamp so the same input always gives the same archive. Names
+ * longer than 100 characters are split to the ustar prefix field.
+ */
+bool writeTarMember(FILE *out, const char *name, const void *data, size_t length);
+
+/*
+ * Write the two zero blocks ending the archive.
+ */
+bool finishTar(FILE *out);
+
+#endif
@@ -0,0 +1,199 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cerrno>
+#include <map>
+#include <unordered_map>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "watch.h"
+
+#ifdef __linux__
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+                    IN_ONLYDIR | IN_DONT_FOLLOW)
+
+typedef struct
+{
+    int fd;
+    std::string root;
+    std::unordered_map<int, std::string> dirs; /* watch to relative path */
+    std::map<std::string, bool> pending;       /* path to removed */
+} watcher_t;
+
+static std::string joinPath(const std::string& dir, const char *name)
+{
+    return dir.empty() ? std::string(name) : dir + "/" + name;
+}
+
+/*
+ * Watch a directory and everything below it. Files already there are
+ * reported as changed when added is set, they may have been written
+ * before the watch was in place.
+ */
+static bool addWatches(watcher_t& w, const std::string& rel, bool added)
+{
+    std::string full = rel.empty() ? w.root : w.root + "/" + rel;
+    int wd = inotify_add_watch(w.fd, full.c_str(), WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            return true; /* gone already */
+        }
+        fprintf(stderr, "Cannot watch %s: %s\n", full.c_str(), strerror(errno));
+        return false;
+    }
+    w.dirs[wd] = rel;
+
+    DIR *dir = opendir(full.c_str());
+    if (dir == NULL) {
+        return true;
+    }
+    dirent *dp;
+    bool r = true;
+    while (r && (dp = readdir(dir)) != NULL) {
+        if (dp->d_name[0] == '.') {
+            continue;
+        }
+        std::string child = joinPath(rel, dp->d_name);
+        if (dp->d_type == DT_DIR) {
+            r = addWatches(w, child, added);
+        } else if (added && dp->d_type == DT_REG) {
+            w.pending[child] = false;
+        }
+    }
+    closedir(dir);
+    return r;
+}
+
+static bool readEvents(watcher_t& w)
+{
+    alignas(struct inotify_event) char buffer[0x10000];
+    ssize_t n = read(w.fd, buffer, sizeof(buffer));
+    if (n < 0) {
+        return errno == EINTR || errno == EAGAIN;
+    }
+    for (char *p = buffer; p < buffer + n; ) {
+        const struct inotify_event *e = (const struct inotify_event *)p;
+        p += sizeof(struct inotify_event) + e->len;
+
+        if (e->mask & IN_Q_OVERFLOW) {
+            /* the lost events cannot be told apart, so redo every file */
+            fprintf(stderr, "Too many changes at once, rescanning %s\n", w.root.c_str());
+            if (!addWatches(w, "", true)) {
+                return false;
+            }
+            continue;
+        }
+        std::unordered_map<int, std::string>::const_iterator it = w.dirs.find(e->wd);
+        if (e->mask & IN_IGNORED) {
+            if (it != w.dirs.end()) {
+                w.dirs.erase(it);
+            }
+            continue;
+        }
+        if (it == w.dirs.end() || e->len == 0 || e->name[0] == '.') {
+            continue;
+        }
+        std::string rel = joinPath(it->second, e->name);
+        if (e->mask & IN_ISDIR) {
+            if ((e->mask & (IN_CREATE | IN_MOVED_TO)) && !addWatches(w, rel, true)) {
+                return false;
+            }
+            if (e->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                /* stands for everything under it, a moved directory reports nothing else */
+                w.pending[rel] = true;
+            }
+            continue;
+        }
+        /* a new file is reported when it is closed after writing */
+        if (e->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+            w.pending[rel] = false;
+        } else if (e->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            w.pending[rel] = true;
+        }
+    }
+    return true;
+}
+
+bool watchTree(const char *root, int debounceMs,
+               const std::function<bool(const std::vector<watchChange_t>&)>& onChange)
+{
+    watcher_t w;
+    w.root = root;
+    while (w.root.size() > 1 && w.root[w.root.size() - 1] == '/') {
+        w.root.resize(w.root.size() - 1);
+    }
+    w.fd = inotify_init1(IN_CLOEXEC);
+    if (w.fd < 0) {
+        fprintf(stderr, "Cannot watch %s: %s\n", root, strerror(errno));
+        return false;
+    }
+    if (!addWatches(w, "", false)) {
+        close(w.fd);
+        return false;
+    }
+    printf("Watching %s\n", root);
+    fflush(stdout);
+
+    bool r = true;
+    while (r) {
+        struct pollfd pfd;
+        pfd.fd = w.fd;
+        pfd.events = POLLIN;
+        int n = poll(&pfd, 1, w.pending.empty() ? -1 : debounceMs);
+        if (n < 0 && errno != EINTR) {
+            fprintf(stderr, "Watching failed: %s\n", strerror(errno));
+            r = false;
+        } else if (n > 0) {
+            r = readEvents(w);
+        } else if (n == 0) {
+            /* quiet for long enough, hand the batch over */
+            std::vector<watchChange_t> changes;
+            for (std::map<std::string, bool>::const_iterator it = w.pending.begin(); it != w.pending.end(); ++it) {
+                watchChange_t change;
+                change.path = it->first;
+                change.removed = it->second;
+                changes.push_back(change);
+            }
+            w.pending.clear();
+            r = onChange(changes);
+            fflush(stdout);
+        }
+    }
+    close(w.fd);
+    return r;
+}
+
+#else
+
+bool watchTree(const char *root, int debounceMs,
+               const std::function<bool(const std::vector<watchChange_t>&)>& onChange)
+{
+    fprintf(stderr, "Watching needs inotify, it is not available on this system\n");
+    return false;
+}
+
+#endif
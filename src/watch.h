@@ -0,0 +1,52 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Watching the input tree for changes
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_WATCH_H
+#define Q2UNPACK_WATCH_H
+
+#include <string>
+#include "common.h"
+
+/* Quiet time before a batch of changes is handed over, so a file being
+ * saved in several writes is converted once. */
+#define WATCH_DEBOUNCE_MS 250
+
+typedef struct
+{
+    std::string path;   /* relative to the watched root */
+    bool removed;       /* a removed directory stands for all files under it */
+} watchChange_t;
+
+/*
+ * Watch the files under root, subdirectories included, and call
+ * onChange with each batch of changed files once the tree has been
+ * quiet for debounceMs. Runs until onChange returns false, which is
+ * also what this returns, or watching fails.
+ */
+bool watchTree(const char *root, int debounceMs,
+               const std::function<bool(const std::vector<watchChange_t>&)>& onChange);
+
+#endif
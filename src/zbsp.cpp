@@ -0,0 +1,236 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+*/
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "bsp.h"
+#include "zbsp.h"
+
+bool openZBsp(const char *path, zbspFile_t *zbsp)
+{
+    zbsp->fd = open(path, O_RDONLY);
+    if (zbsp->fd < 0) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(zbsp->fd, &st) != 0 || st.st_size < off_t(sizeof(dzheader_t))) {
+        fprintf(stderr, "Bad bspz file %s\n", path);
+        close(zbsp->fd);
+        return false;
+    }
+    zbsp->size = size_t(st.st_size);
+
+    void *base = mmap(NULL, zbsp->size, PROT_READ, MAP_PRIVATE, zbsp->fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s\n", path);
+        close(zbsp->fd);
+        return false;
+    }
+    zbsp->base = (const byte *)base;
+    zbsp->header = (const dzheader_t *)base;
+
+    const dzheader_t *h = zbsp->header;
+    bool r = LittleLong(h->ident) == IDZBSPHEADER && LittleLong(h->version) == ZBSP_VERSION &&
+        LittleLong(h->numlumps) == HEADER_LUMPS;
+    for (int i = 0; i < HEADER_LUMPS && r; i++) {
+        const dzlump_t *l = &h->lumps[i];
+        int ofs = LittleLong(l->fileofs);
+        int len = LittleLong(l->filelen);
+        if (ofs < 0 || len < 0 || LittleLong(l->length) < 0 || (ofs % ZBSP_ALIGN) != 0 ||
+            size_t(ofs) + len > zbsp->size ||
+            (LittleLong(l->method) != ZLUMP_STORED && LittleLong(l->method) != ZLUMP_DEFLATED)) {
+            r = false;
+        }
+    }
+    if (!r) {
+        fprintf(stderr, "Bad bspz file %s\n", path);
+        closeZBsp(zbsp);
+        return false;
+    }
+    return true;
+}
+
+byte *loadZBspLump(const zbspFile_t *zbsp, int lump, int *length)
+{
+    const dzlump_t *l = &zbsp->header->lumps[lump];
+    int len = LittleLong(l->length);
+    const byte *src = zbsp->base + LittleLong(l->fileofs);
+
+    byte *data = (byte *)malloc(len + 1);
+    if (data == NULL) {
+        fprintf(stderr, "Out of memory loading lump %d\n", lump);
+        return NULL;
+    }
+
+    if (LittleLong(l->method) == ZLUMP_STORED) {
+        if (LittleLong(l->filelen) != len) {
+            fprintf(stderr, "Bad stored lump %d\n", lump);
+            free(data);
+            return NULL;
+        }
+        memcpy(data, src, len);
+    } else {
+        uLongf destlen = uLongf(len);
+        if (uncompress(data, &destlen, src, uLong(LittleLong(l->filelen))) != Z_OK ||
+            destlen != uLongf(len)) {
+            fprintf(stderr, "Failed to inflate lump %d\n", lump);
+            free(data);
+            return NULL;
+        }
+    }
+
+    if (crc32(crc32(0, Z_NULL, 0), data, uInt(len)) != LittleLong(l->crc)) {
+        fprintf(stderr, "Crc mismatch in lump %d\n", lump);
+        free(data);
+        return NULL;
+    }
+
+    data[len] = 0;
+    *length = len;
+    return data;
+}
+
+void closeZBsp(zbspFile_t *zbsp)
+{
+    munmap((void *)zbsp->base, zbsp->size);
+    close(zbsp->fd);
+}
+
+static bool writeZBsp(const bspFile_t *bsp, const char *path)
+{
+    dzheader_t header;
+    memset(&header, 0, sizeof(header));
+    header.ident = LittleLong(IDZBSPHEADER);
+    header.version = LittleLong(ZBSP_VERSION);
+    header.bspversion = LittleLong(bsp->header.version);
+    header.numlumps = LittleLong(HEADER_LUMPS);
+
+    std::vector<byte> body;
+    long ofs = sizeof(header);
+    for (int i = 0; i < HEADER_LUMPS; i++) {
+        int len;
+        byte *data = (byte *)loadBspLump(bsp, i, 1, &len);
+        if (data == NULL) {
+            return false;
+        }
+
+        uLongf zlen = compressBound(uLong(len));
+        std::vector<byte> z(zlen);
+        bool deflated = compress2(z.data(), &zlen, data, uLong(len), Z_BEST_COMPRESSION) == Z_OK &&
+            zlen < uLongf(len);
+
+        /* every lump starts aligned */
+        long pad = (ZBSP_ALIGN - (ofs + long(body.size())) % ZBSP_ALIGN) % ZBSP_ALIGN;
+        body.insert(body.end(), pad, 0);
+
+        dzlump_t *l = &header.lumps[i];
+        l->fileofs = LittleLong(int(ofs + body.size()));
+        l->length = LittleLong(len);
+        l->crc = LittleLong(unsigned(crc32(crc32(0, Z_NULL, 0), data, uInt(len))));
+        if (deflated) {
+            l->method = LittleLong(ZLUMP_DEFLATED);
+            l->filelen = LittleLong(int(zlen));
+            body.insert(body.end(), z.begin(), z.begin() + zlen);
+        } else {
+            l->method = LittleLong(ZLUMP_STORED);
+            l->filelen = LittleLong(len);
+            body.insert(body.end(), data, data + len);
+        }
+        free(data);
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return false;
+    }
+    bool r = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(body.data(), 1, body.size(), f) == body.size();
+    if (fclose(f) != 0 || !r) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Read every lump back and compare it with the source BSP.
+ */
+static bool verifyZBsp(const bspFile_t *bsp, const char *path)
+{
+    zbspFile_t zbsp;
+    if (!openZBsp(path, &zbsp)) {
+        return false;
+    }
+
+    bool r = true;
+    for (int i = 0; i < HEADER_LUMPS && r; i++) {
+        int len, zlen;
+        byte *orig = (byte *)loadBspLump(bsp, i, 1, &len);
+        byte *data = loadZBspLump(&zbsp, i, &zlen);
+        if (orig == NULL || data == NULL || len != zlen || memcmp(orig, data, len) != 0) {
+            fprintf(stderr, "Lump %d of %s does not match\n", i, path);
+            r = false;
+        }
+        free(orig);
+        free(data);
+    }
+    closeZBsp(&zbsp);
+    return r;
+}
+
+bool exportCompressedMaps(const char *outPath, const std::vector<bool>& selected)
+{
+    std::vector<const fileEntry *> maps;
+    findSelectedMaps(selected, maps);
+
+    long total = 0, compressed = 0;
+    std::vector<long> sizes(maps.size(), 0);
+    bool r = parallelFor(int(maps.size()), [&](int i) {
+        const fileEntry& entry = *maps[i];
+        bspFile_t bsp;
+        char fullpath[1024];
+        if (!openBsp(entry, &bsp) ||
+            !createOutputPath(outPath, entry.name, ".bspz", fullpath, sizeof(fullpath)) ||
+            !writeZBsp(&bsp, fullpath) || !verifyZBsp(&bsp, fullpath)) {
+            return false;
+        }
+
+        struct stat st;
+        if (stat(fullpath, &st) == 0) {
+            sizes[i] = long(st.st_size);
+        }
+        return true;
+    });
+
+    for (size_t i = 0; i < maps.size(); i++) {
+        total += maps[i]->length;
+        compressed += sizes[i];
+    }
+    printf("Compressed maps: %lu maps, %ld -> %ld bytes\n", maps.size(), total, compressed);
+    return r;
+}
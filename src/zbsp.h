@@ -0,0 +1,89 @@
+/*
+* Copyright (C) 2019      Iiro Kaihlaniemi
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or (at
+* your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but
+* WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*
+* See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+* 02111-1307, USA.
+*
+* =======================================================================
+*
+*  Maps with individually compressed lumps (.bspz)
+*
+* =======================================================================
+*/
+
+#ifndef Q2UNPACK_ZBSP_H
+#define Q2UNPACK_ZBSP_H
+
+#include "common.h"
+
+/* A .bspz has the same lumps as the BSP it was made of. Every lump is
+ * deflated on its own (or stored if that does not help) and starts at
+ * a 16 byte aligned offset, so a loader can mmap the file and inflate
+ * only the lumps it needs. */
+
+#define IDZBSPHEADER (('Z' << 24) + ('P' << 16) + ('S' << 8) + 'B') /* little-endian "BSPZ" */
+#define ZBSP_VERSION 1
+#define ZBSP_ALIGN 16
+
+#define ZLUMP_STORED 0
+#define ZLUMP_DEFLATED 1
+
+typedef struct
+{
+    int fileofs;   /* from the start of the file, ZBSP_ALIGN aligned */
+    int filelen;   /* stored size */
+    int length;    /* size of the lump in the BSP */
+    int method;    /* ZLUMP_* */
+    unsigned crc;  /* crc32 of the uncompressed lump */
+} dzlump_t;
+
+typedef struct
+{
+    int ident;
+    int version;
+    int bspversion;
+    int numlumps;
+    dzlump_t lumps[HEADER_LUMPS];
+} dzheader_t;
+
+typedef struct
+{
+    int fd;
+    const byte *base;
+    size_t size;
+    const dzheader_t *header;
+} zbspFile_t;
+
+/*
+ * Map a .bspz file and validate its index.
+ */
+bool openZBsp(const char *path, zbspFile_t *zbsp);
+
+/*
+ * Inflate one lump to a malloc'd buffer and check its crc.
+ * Returns NULL on failure.
+ */
+byte *loadZBspLump(const zbspFile_t *zbsp, int lump, int *length);
+
+void closeZBsp(zbspFile_t *zbsp);
+
+/*
+ * Write every selected map as maps/<name>.bspz and verify it by reading
+ * each lump back through loadZBspLump.
+ */
+bool exportCompressedMaps(const char *outPath, const std::vector<bool>& selected);
+
+#endif